@@ -26,17 +26,32 @@
  |		- '2' --> apply Rule 2 (Coral: B3/S45678)							|
  |		- '3' --> apply Rule 3 (Amoeba: B357/S1358)							|
  |		- '4' --> apply Rule 4 (Maze: B3/S12345)							|
+ |		- 'r' --> apply the next rule in the list of known rulestrings		|
+ |		- 'h' --> jump ahead 2^k generations with the HashLife engine		|
  |																			|
  +-------------------------------------------------------------------------*/
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <cstring>
+#include <cstdint>
 #include <ctime>
+#include <cstdio>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <pthread.h>
+#include <atomic>
 #include "gl_frontEnd.h"
 #include <random>
+#include <string>
+#include <vector>
+#include <deque>
 
 using namespace std;
 
@@ -47,6 +62,23 @@ using namespace std;
 //==================================================================================
 #endif
 
+//	Storage type of a cell of the scalar grids.  A cell is only dead (0) or
+//	alive (1), so a byte is enough; in color mode the age of the cells is
+//	kept in a separate plane of the same type (see currentAge2D).
+typedef uint8_t CellType;
+
+//	Counts of a generation, accumulated by a thread while it computes its
+//	cells: the births and deaths of the cells it computed, and (reset passes
+//	only) the number of live cells it put in the grid.  hashChange is the
+//	change of the grid hash (cycle detection only), combined with XOR.
+typedef struct CellStats
+{
+	uint64_t population;
+	uint64_t births;
+	uint64_t deaths;
+	uint64_t hashChange;
+} CellStats;
+
 typedef struct ThreadInfo
 {
 	//	you probably want these
@@ -54,9 +86,165 @@ typedef struct ThreadInfo
 	int threadIndex;
 	unsigned int startRow;
 	unsigned int endRow;
-	bool complete;
+	//	time spent computing and waiting at the barrier, in seconds
+	double busyTime;
+	double idleTime;
+	//	counts of the generation being computed, reduced by endGeneration,
+	//	and births + deaths of the last generation computed by this thread
+	CellStats stats;
+	atomic<uint64_t> activity;
 } ThreadInfo;
 
+//	A reusable barrier for the computation threads.  The epoch counts how
+//	many times the barrier has been crossed, so that a thread woken up by
+//	a late broadcast can tell whether it may leave.
+typedef struct GenerationBarrier
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int numThreads;
+	unsigned int numWaiting;
+	unsigned int epoch;
+} GenerationBarrier;
+
+//	A rule compiled from its rulestring (see compileRule).  A Life-like rule
+//	("B3/S23") looks at the 8 neighbors of a cell, which is dead or alive.
+//	A Larger-than-Life rule looks at the (2 radius + 1)^2 - 1 cells around a
+//	cell (the cell itself too if countMiddle), and a Generations rule has
+//	numStates - 2 dying states, which a live cell that does not survive goes
+//	through before it is dead.  birthCounts[k] (surviveCounts[k]) is 1 if a
+//	dead (live) cell with k live neighbors is alive at the next generation.
+//	The Life-like kernels use the same sets of counts as bit masks (bit k
+//	set if count k is in the set), which can be applied to a whole vector of
+//	cells with a shift instead of a table lookup; the other rules need the
+//	extended kernel.
+#define MAX_RULE_RADIUS		16
+#define MAX_RULE_COUNT		((2 * MAX_RULE_RADIUS + 1) * (2 * MAX_RULE_RADIUS + 1))
+//	unsigned ints of a thread's scratch for the extended kernel: the column
+//	sums and the cells of a row, each as wide as the grid plus two radii
+#define EXTENDED_SCRATCH_SIZE	(2 * (NUM_COLS + 2 * MAX_RULE_RADIUS))
+typedef struct RuleTable
+{
+	char name[32];
+	unsigned int birthMask;
+	unsigned int surviveMask;
+	unsigned int radius;
+	unsigned int numStates;
+	bool countMiddle;
+	bool extended;
+	unsigned char birthCounts[MAX_RULE_COUNT + 1];
+	unsigned char surviveCounts[MAX_RULE_COUNT + 1];
+} RuleTable;
+
+//	A node of the HashLife quadtree.  A node of level k is a square of
+//	2^k x 2^k cells made of four nodes of level k-1; level 0 nodes are single
+//	cells.  Nodes are canonical (there is only one node for a given set of
+//	four children) so they are never modified once created, except for the
+//	memoized results.
+typedef struct HashNode
+{
+	struct HashNode* nw;
+	struct HashNode* ne;
+	struct HashNode* sw;
+	struct HashNode* se;
+	struct HashNode* next;			//	next node of the same hash table bucket
+	struct HashNode* result;		//	center square advanced 2^(level-2) generations
+	struct HashNode* stepResult;	//	center square advanced 2^stepLog generations
+	uint64_t population;
+	unsigned int level;
+	unsigned int stepLog;
+	bool marked;
+} HashNode;
+
+//	A horizontal run of live cells of a pattern (--pattern <file>)
+typedef struct PatternRun
+{
+	unsigned int row;
+	unsigned int col;
+	unsigned int length;
+} PatternRun;
+
+//	Header of a checkpoint file.  It fills the first page of the file, and is
+//	followed by the bit-packed current grid, stored with the same padding
+//	as in memory ((numRows+2) rows of wordsPerRow 64-bit words), so that a
+//	restore can map the grid straight into memory.
+#define CHECKPOINT_MAGIC		"CASNAP02"
+#define CHECKPOINT_HEADER_SIZE	4096
+typedef struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t numRows;
+	uint32_t numCols;
+	uint32_t wordsPerRow;
+	uint32_t frameBehavior;
+	uint64_t generation;
+	char rule[32];
+	uint64_t randomSeed;
+	uint64_t numResets;
+} CheckpointHeader;
+
+//	A job of the batch mode (--batch <file>): an independent board, run for
+//	a number of generations from a random grid, and its results
+typedef struct BatchJob
+{
+	char rule[32];
+	unsigned int densityLevel;
+	uint64_t seed;
+	unsigned int numRows;
+	unsigned int numCols;
+	unsigned int numGenerations;
+	//	results
+	uint64_t population;			//	at the last generation
+	unsigned int period;			//	0 if the board did not repeat
+	unsigned int stableGeneration;	//	first generation of the cycle
+	unsigned int generationsComputed;
+} BatchJob;
+
+//	A board of the batch mode: a bit-packed grid with the same layout as
+//	currentBits, its rule, and the history of its hashes.  Each thread of
+//	the batch has one board, reused from one job to the next so that it
+//	stays in the thread's cache.
+typedef struct Board
+{
+	unsigned int numRows;
+	unsigned int numCols;
+	unsigned int wordsPerRow;
+	unsigned int birthMask;
+	unsigned int surviveMask;
+	vector<uint64_t> bits;
+	vector<uint64_t> nextBits;
+	uint64_t hash;
+	vector<uint64_t> history;
+	vector<unsigned int> historyGenerations;
+} Board;
+
+//	A tile of the multi-process mode (--processes <p>x<q>), in the shared
+//	memory segment.  published is the number of generations whose edges the
+//	process of the tile has made available to its neighbors; the rest is
+//	written by the process at the end of the run, for the parent's report.
+typedef struct alignas(64) TileInfo
+{
+	unsigned int startRow;
+	unsigned int endRow;
+	unsigned int startCol;			//	a multiple of 64
+	unsigned int endCol;
+	atomic<uint64_t> published;
+	double computeTime;
+	double exchangeTime;
+	double waitTime;
+	uint64_t population;
+} TileInfo;
+
+//	The jobs left to a thread of the batch.  The thread takes them from the
+//	front, and threads that ran out of jobs steal them from the back.
+typedef struct alignas(64) BatchQueue
+{
+	pthread_mutex_t lock;
+	deque<unsigned int> jobs;
+	unsigned int numRun;
+	unsigned int numStolen;
+} BatchQueue;
+
 
 #if 0
 //==================================================================================
@@ -71,7 +259,116 @@ void initializeApplication(unsigned int numRows, unsigned int numCols);
 void cleanupAndquit(void);
 void* threadFunc(void*);
 void swapGrids(void);
-unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows, unsigned int numCols);
+void endGeneration(void);
+void startThreads(void);
+void joinThreads(void);
+void runBenchmark(unsigned int maxThreads);
+double currentTime(void);
+void initBarrier(GenerationBarrier* barrier, unsigned int numThreads);
+void waitBarrier(GenerationBarrier* barrier, void (*lastThreadFunc)(void));
+template <typename CellT>
+static inline unsigned int cellNewState(const CellT* above, const CellT* row, const CellT* below, int j,
+										unsigned int birthMask, unsigned int surviveMask);
+template <typename CellT>
+CellT** newGrid2D(unsigned int numRows, unsigned int numCols);
+template <typename CellT>
+void deleteGrid2D(CellT** grid2D);
+template <typename CellT>
+bool computeScalarRegion(CellT** grid2D, CellT** next2D, CellT** age2D, CellT** nextAge2D,
+						 unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol,
+						 CellStats* stats);
+template <typename CellT>
+void uncountDeadBorder(CellT** grid2D, CellT** next2D, unsigned int startRow, unsigned int endRow,
+					   unsigned int startCol, unsigned int endCol, CellStats* stats);
+template <typename CellT>
+static inline void uncountBorderCell(CellT state, CellT newState, CellStats* stats);
+template <typename CellT>
+void clearDeadBorder(CellT** grid2D, unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol);
+static inline uint64_t gridWordHash(uint64_t index, uint64_t word);
+template <typename CellT>
+bool computeExtendedRegion(CellT** grid2D, CellT** next2D, CellT** age2D, CellT** nextAge2D,
+						   unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol,
+						   unsigned int* scratch, CellStats* stats);
+template <typename CellT>
+void loadExtendedRow(CellT** grid2D, int i, int firstCol, unsigned int width, unsigned char* cells);
+template <typename CellT>
+static inline uint64_t cellWord(const CellT* row, unsigned int j);
+template <typename CellT>
+uint64_t rowHashChange(const CellT* row, const CellT* out, unsigned int i, unsigned int startCol, unsigned int endCol);
+uint64_t computeGridHash(void);
+void startCycleHistory(void);
+void checkCycle(void);
+void resetAges(void);
+void toggleColorMode(void);
+void initializeRenderFrames(void);
+void poolFrameRows(unsigned int startRow, unsigned int endRow);
+void publishFrame(void);
+static inline uint64_t randomHash(uint64_t key, uint64_t counter);
+static inline uint64_t randomDensityWord(uint64_t key, uint64_t counter, unsigned int level);
+void fillInitialRows(unsigned int startRow, unsigned int endRow, CellStats* stats);
+void* resetThreadFunc(void* arg);
+void finishReset(void);
+void loadPattern(const char* fileName);
+static inline unsigned int haloRandomCell(int i, int j);
+void startCheckpointWriter(void);
+void stopCheckpointWriter(bool writeLast);
+bool requestCheckpoint(bool wait);
+void* checkpointThreadFunc(void*);
+void readCheckpointHeader(const char* fileName, CheckpointHeader* header, size_t* fileSize);
+void restoreCheckpoint(const char* fileName);
+void unmapCheckpoint(void);
+void fillHalo(void);
+void parseOptions(int argc, const char* argv[]);
+void computeRows(unsigned int startRow, unsigned int endRow, unsigned int* scratch, CellStats* stats);
+bool computeRegion(unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol,
+				   unsigned int* scratch, CellStats* stats);
+void computeDirtyTiles(unsigned int* scratch, CellStats* stats);
+void oneGeneration(void);
+void computeTemporalBand(unsigned int startRow, unsigned int endRow, uint64_t* scratch, CellStats* stats);
+void collectStats(CellStats* total);
+void writeStatsHeader(void);
+void writeStatsLine(void);
+uint64_t countPopulation(void);
+void drawStateLine(unsigned int line, const string& text);
+bool sameAsSavedGrid(const vector<CellType>& savedGrid, const vector<uint64_t>& savedBits);
+void buildDirtyTileList(void);
+bool compileRule(const char* ruleString, RuleTable* table);
+bool compileLifeRule(const char* ruleString, RuleTable* table);
+bool compileLargerThanLifeRule(const char* ruleString, RuleTable* table);
+bool sameRule(const RuleTable* a, const RuleTable* b);
+void selectRule(unsigned int index);
+void applyPendingRule(void);
+void bitRowNewState(const uint64_t* above, const uint64_t* row, const uint64_t* below,
+					uint64_t* out, unsigned int numWords, unsigned int birthMask, unsigned int surviveMask);
+void bitFixBorder(unsigned int i, unsigned int startCol, unsigned int endCol);
+template <typename CellT>
+void packGrid(CellT** grid, uint64_t* bits);
+HashNode* hashLifeNode(HashNode* nw, HashNode* ne, HashNode* sw, HashNode* se);
+HashNode* hashLifeEmpty(unsigned int level);
+HashNode* hashLifeAdvance(HashNode* node, unsigned int stepLog);
+uint64_t hashLifeStep(unsigned int stepLog);
+void hashLifeFromGrid(void);
+void hashLifeToGrid(void);
+void hashLifeCollect(void);
+void hashLifeJump(void);
+void runHashLife(void);
+template <typename CellT>
+void unpackGrid(const uint64_t* bits, CellT** grid);
+void runProcesses(void);
+void runTileProcess(unsigned int tile);
+uint64_t* tileEdge(unsigned int tile, unsigned int parity, unsigned int side);
+int neighborTile(unsigned int tile, int rowStep, int colStep);
+void fillTile(const TileInfo* info, uint64_t* bits, unsigned int wordsPerRow);
+void publishTileEdges(unsigned int tile, unsigned int parity, const uint64_t* bits, unsigned int wordsPerRow);
+void readTileHalo(unsigned int tile, unsigned int parity, uint64_t* bits, unsigned int wordsPerRow);
+void loadBatchJobs(const char* fileName);
+void runBatch(unsigned int numThreads);
+void* batchThreadFunc(void* arg);
+bool takeBatchJob(unsigned int threadIndex, unsigned int numThreads, unsigned int* job);
+void runBoard(Board* board, BatchJob* job);
+void fillBoard(Board* board, const BatchJob* job);
+void fillBoardHalo(Board* board);
+void boardGeneration(Board* board);
 
 
 #if 0
@@ -86,8 +383,13 @@ unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows,
 #define FRAME_CLIPPED	2	//	same rule as elsewhere, with clipping to stay within bounds
 #define FRAME_WRAP		3	//	same rule as elsewhere, with wrapping around at edges
 
-//	Pick one value for FRAME_BEHAVIOR
-#define FRAME_BEHAVIOR	FRAME_DEAD
+//	The grids have a one-cell halo all around, filled once per generation
+//	according to the frame behavior (zeros, random cells, or a copy of the
+//	opposite edge), so that every cell of the grid can be computed the same
+//	way.  The frame behavior is picked at startup with --frame.
+unsigned int frameBehavior = FRAME_DEAD;
+bool frameGiven = false;
+const char* frameNames[] = {"dead", "random", "clipped", "wrap"};
 
 #if 0
 //==================================================================================
@@ -103,21 +405,136 @@ extern int gMainWindow, gSubwindow[2];
 //		- currentGrid is the one displayed in the graphic front end
 //		- nextGrid is the grid that stores the next generation of cell
 //			states, as computed by our threads.
-unsigned int* currentGrid;
-unsigned int* nextGrid;
-unsigned int** currentGrid2D;
-unsigned int** nextGrid2D;
+//	Both are allocated with their halo, (NUM_ROWS+2) x (NUM_COLS+2) cells.
+//	currentGrid2D[i][j] is cell (i, j) of the grid for i, j in [-1, size],
+//	so the halo cells are at index -1 and NUM_ROWS or NUM_COLS.
+CellType* currentGrid;
+CellType* nextGrid;
+CellType** currentGrid2D;
+CellType** nextGrid2D;
+
+//	Color mode only: the age of each cell, from 1 (newborn) to NB_COLORS-1
+//	(very old), 0 for a dead cell.  Same layout as the state grids, allocated
+//	when color mode is turned on and released when it is turned off.
+CellType** currentAge2D = NULL;
+CellType** nextAge2D = NULL;
+
+//	The display (GUI mode only) draws a downsampled copy of the grid, at most
+//	displaySize x displaySize cells (--display <n>).  Each cell of this frame
+//	is the maximum (color mode) or "any alive" of a block of renderBlockRows x
+//	renderBlockCols cells.  When the display asks for a frame, the threads
+//	fill it during the next generation (while the current grid cannot
+//	change), each one a band of the frame, and endGeneration publishes it.
+//	The frames go through a triple buffer, so that neither side ever waits
+//	for the other: the threads fill backFrame, the display draws frontFrame,
+//	and readyFrame holds the latest complete one (RENDER_FRESH if the display
+//	has not taken it yet).
+#define RENDER_FRESH	4
+unsigned int displaySize = 512;
+unsigned int renderRows, renderCols, renderBlockRows, renderBlockCols;
+unsigned int** renderFrame[3];
+unsigned int backFrame = 0, frontFrame = 1;
+atomic<unsigned int> readyFrame(2);
+atomic<bool> frameRequested(false);
+bool framePass = false;
+
+//	Bit-packed version of the same two grids, one bit per cell.  Each row
+//	is stored as bitWordsPerRow 64-bit words: word 0 and the last word are
+//	padding so that the kernel can read the left/right neighbor words without
+//	any test, and column j lives in word 1 + j/64, bit j%64.  The halo cells
+//	of a row are column -1 (bit 63 of word 0) and column NUM_COLS, and the
+//	halo rows are the padding rows above and below the grid.
+//	Only allocated and used when bitPackedMode is on (--bitpacked).
+bool bitPackedMode = false;
+uint64_t* currentBits = NULL;
+uint64_t* nextBits = NULL;
+unsigned int bitWordsPerRow = 0;
+
+//	Sparse mode (--sparse): the grid is divided in TILE_SIZE x TILE_SIZE
+//	tiles and only the tiles that changed during the last generation, or
+//	that have a neighbor tile that changed, are recomputed.  A tile that did
+//	not change has the same contents in both grids, so skipping it leaves
+//	the next grid correct.  The threads pull the dirty tiles from a shared
+//	list instead of computing a fixed band of rows.
+#define TILE_SIZE	64
+bool sparseMode = false;
+unsigned int numTileRows, numTileCols;
+unsigned char* tileChanged = NULL;		//	tiles that changed in the last generation
+unsigned char* nextTileChanged = NULL;	//	tiles that change in this generation
+unsigned int* dirtyTiles = NULL;		//	tiles to compute in this generation
+unsigned int numDirtyTiles = 0;
+atomic<unsigned int> nextDirtyTile(0);
+atomic<bool> allTilesDirty(true);		//	forces a full recomputation
+unsigned long long tilesComputed = 0;
+
+//	HashLife engine.  The grid is converted to a quadtree, advanced by 2^k
+//	generations at once, then converted back ('h' key or --hashlife <k>).
+//	The quadtree lives on an infinite plane, so the frame behavior is not
+//	applied, and live cells that leave the grid are lost on the way back.
+vector<HashNode*> hashTable;				//	all the nodes of level 1 and above
+uint64_t hashNodeCount = 0;
+uint64_t hashMemoryCap = 1024 * 1024 * 1024;	//	in bytes, --hashlife-mem <MB>
+bool hashLifeCapped = false;				//	a step stops when the nodes exceed the cap
+bool hashLifeAborted = false;				//	and sets this
+HashNode hashLeaf[2];						//	the dead and the live cell
+vector<HashNode*> hashEmptyNodes;			//	the empty node of each level
+HashNode* hashRoot = NULL;
+int64_t hashRootRow, hashRootCol;			//	grid coordinates of the root's corner
+unsigned int hashBirthMask, hashSurviveMask;	//	rule of the memoized results
+//	The coordinates of the cells of the root must fit in 64 bits, so the
+//	root is at most 2^MAX_HASHLIFE_LEVEL cells wide.  The root of a step of
+//	2^k generations is at least 2^(k+3) cells wide, plus the levels it needs
+//	to hold the pattern.
+#define MAX_HASHLIFE_LEVEL		62
+#define MAX_HASHLIFE_STEP_LOG	56
+unsigned int hashLifeStepLog = 10;
+bool hashLifeMode = false;
+atomic<bool> hashLifeRequested(false);
+
+//	Temporal tiling (--temporal <k>, headless and bit-packed only): instead of
+//	streaming the whole grid through memory once per generation, each thread
+//	loads a block of rows that fits in its cache, plus k rows above and below,
+//	and advances it k generations before writing it back.  The extra rows are
+//	computed redundantly by the neighboring blocks, and shrink by one row per
+//	generation.  The threads then only meet at the barrier every k generations.
+unsigned int temporalSteps = 0;
+unsigned int passSteps = 1;					//	generations computed between two barriers
+const unsigned int TEMPORAL_CACHE_SIZE = 256 * 1024;
+bool verifyMode = false;
 
 unsigned int NUM_ROWS, NUM_COLS, NUM_THREADS;
 
 //	the number of live computation threads (that haven't terminated yet)
-unsigned short numLiveThreads = 0;
+atomic<unsigned short> numLiveThreads(0);
+
+//	The rule currently applied by the threads.  A rule selected from the
+//	keyboard is only compiled into pendingRule, and becomes the active rule
+//	at the next generation boundary so that a generation never mixes rules.
+RuleTable activeRule;
+RuleTable pendingRule;
+bool rulePending = false;
 
-unsigned int rule = GAME_OF_LIFE_RULE;
+//	Rulestrings that the keyboard can select.  The first four are the rules
+//	of keys '1' to '4', 'r' cycles through all of them.  Rules given with
+//	--rule at startup are appended to the list.
+vector<string> ruleList = {
+	"B3/S23",			//	Conway's Game of Life
+	"B3/S45678",		//	Coral Growth
+	"B357/S1358",		//	Amoeba
+	"B3/S12345",		//	Maze
+	"B36/S23",			//	HighLife
+	"B3678/S34678",		//	Day & Night
+	"B2/S",				//	Seeds
+	"B1357/S1357",		//	Replicator
+	"B2/S/C3",			//	Brian's Brain (Generations)
+	"R5,C0,M1,S34..58,B34..45,NM"	//	Bosco's Rule (Larger than Life)
+};
+unsigned int ruleListIndex = 0;
+bool ruleGiven = false;
 
 unsigned int colorMode = 0;
 
-unsigned int generation = 0;
+uint64_t generation = 0;
 
 
 
@@ -129,13 +546,118 @@ const unsigned int minThreadSleepTime = 10000;
 
 //Set up the thread and lock as global vars
 ThreadInfo* threadInfo;
-pthread_mutex_t lock;
 
-//Set up a rendom engine
-random_device randDev;
-default_random_engine engine(randDev());
-uniform_int_distribution<unsigned int> uniformDist(0, 1);
-uniform_int_distribution<unsigned int> uniformDistLong(0,8);
+//	All computation threads meet at this barrier at the end of each
+//	generation.  The last one to arrive runs endGeneration() while the
+//	others are blocked, so that the grids are swapped exactly once.
+GenerationBarrier generationBarrier;
+
+//	Headless benchmark mode (--headless): no GUI, no sleeping, the threads
+//	stop on their own once generation reaches lastGeneration (0 = never).
+bool headlessMode = false;
+uint64_t lastGeneration = 0;
+unsigned int benchmarkThreads = 0;
+
+//	Requests coming from the GUI, handled at the end of a generation.
+//	stopWorkers is only written by endGeneration and read after the barrier.
+atomic<bool> stopRequested(false);
+atomic<bool> resetRequested(false);
+atomic<bool> colorModeRequested(false);
+bool stopWorkers = false;
+
+//	Checkpoints (--checkpoint <file>, --checkpoint-every <n>): every n
+//	generations, endGeneration copies the current grid into checkpointBits and
+//	a writer thread saves it while the workers go on.  A checkpoint that
+//	comes while the previous one is still being written is skipped.
+const char* checkpointFile = NULL;
+const char* restoreFile = NULL;
+//	the restored checkpoint file, mapped as a bit grid (bit-packed mode only)
+char* restoreMapping = NULL;
+size_t restoreMappingSize = 0;
+unsigned int checkpointEvery = 0;
+uint64_t nextCheckpoint = 0;
+CheckpointHeader checkpointHeader;
+uint64_t* checkpointBits = NULL;
+pthread_t checkpointThread;
+pthread_mutex_t checkpointLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t checkpointCond = PTHREAD_COND_INITIALIZER;
+bool checkpointPending = false;
+bool checkpointExit = false;
+
+//	Random numbers are counter-based (see randomHash): the random value of a
+//	cell only depends on the seed (--seed <n>), on what it is drawn for, and
+//	on the position of the cell and the generation or reset number.  Any
+//	thread can draw it without sharing state, and a run can be reproduced.
+#define RANDOM_STREAM_RESET		0
+#define RANDOM_STREAM_FRAME		1
+uint64_t randomSeed;
+bool randomSeedGiven = false;
+uint64_t numResets = 0;
+
+//	The initial grid: either random cells, alive with probability
+//	densityLevel/256 (--density <p>), or a pattern centered on an empty grid.
+//	On a reset, the threads fill their own band of the next grid (resetPhase).
+unsigned int densityLevel = 128;
+vector<PatternRun> patternRuns;
+unsigned int patternRows = 0, patternCols = 0;
+bool resetPhase = false;
+
+//	Statistics of the last generation, reduced at the barrier from the
+//	counters of the threads.  The population is updated from the births and
+//	deaths of each generation, and counted from scratch when the grid is
+//	replaced (reset, restore, HashLife jump).  With --stats <file>, a line
+//	is written to the file at each generation.
+atomic<uint64_t> population(0);
+atomic<uint64_t> lastBirths(0), lastDeaths(0);
+const char* statsFileName = NULL;
+ofstream statsFile;
+
+//	Cycle detection (--cycles <n>): the grid has a 64-bit hash, the XOR of
+//	the hashes of its words of cells (8 cells of the scalar grid, 64 of the
+//	bit grid) and their position.  The kernels update it with the words that
+//	changed, and endGeneration looks it up in a ring of the hashes of the
+//	last n generations: a match means that the grid repeats with that period
+//	(1 for a still life).  A headless run then skips ahead by a multiple of
+//	the period, and only computes the generations that are left.
+unsigned int cycleHistorySize = 0;
+vector<uint64_t> cycleHashes;
+vector<uint64_t> cycleGenerations;
+unsigned int cycleNext = 0;
+uint64_t gridHash = 0;
+atomic<unsigned int> cyclePeriod(0);		//	0 until a cycle is found
+
+//	Multi-process mode (--processes <p>x<q>, headless): the grid is split
+//	into p x q tiles, each computed by its own process, which only allocates
+//	its tile.  The processes share the edges of their tiles, through a shared
+//	memory segment: at each generation, a process publishes its edges,
+//	computes the inside of its tile, then waits for the edges of its eight
+//	neighbors to compute the cells along its own edges.  The edges are
+//	double-buffered (by generation parity), so a process only ever waits for
+//	its neighbors.  The columns of the tiles start at multiples of 64, so
+//	that a tile is made of whole words of the bit grid.
+#define EDGE_TOP		0
+#define EDGE_BOTTOM		1
+#define EDGE_LEFT		2
+#define EDGE_RIGHT		3
+unsigned int processRows = 0, processCols = 0;
+TileInfo* tiles = NULL;
+uint64_t* tileEdges = NULL;
+size_t tileEdgeWords = 0;
+uint64_t* gatheredBits = NULL;			//	--verify: the tiles at the end of the run
+
+//	Batch mode (--batch <file>): many independent boards, run concurrently
+//	by a pool of threads instead of a single grid.  The jobs are dealt to the
+//	threads in contiguous blocks, and a thread that runs out of jobs steals
+//	them from the others.
+const char* batchFile = NULL;
+vector<BatchJob> batchJobs;
+BatchQueue* batchQueues = NULL;
+
+//	Position of the statistics in the state pane, below the state drawn by
+//	drawState (in pixels)
+#define STATE_TEXT_LEFT		10
+#define STATE_TEXT_TOP		100
+#define STATE_LINE_HEIGHT	18
 
 
 #if 0
@@ -148,7 +670,7 @@ uniform_int_distribution<unsigned int> uniformDistLong(0,8);
 int main(int argc, const char* argv[])
 {
 	unsigned int numRow, numCol, numThread;
-	if(argc == 4)
+	if(argc >= 4)
 	{
 		stringstream ss;
 		ss << argv[1] << ' ' << argv[2] << ' ' << argv[3];
@@ -164,21 +686,509 @@ int main(int argc, const char* argv[])
 	}
 	else
 	{
-		cout << "Usage:" << argv[0] << " <Width> <Height> <Number of threads, must be less than height>" <<  endl;
+		cout << "Usage:" << argv[0] << " <Width> <Height> <Number of threads, must be less than height> [options]" <<  endl;
+		cout << "Options:" << endl;
+		cout << "\t--bitpacked\tstore one bit per cell and use the 64-cells-per-word kernel" << endl;
+		cout << "\t--rule <rule>\tstart with a rule given as a rulestring: Life-like (B36/S23), Generations (B2/S/C3)," << endl;
+		cout << "\t\tor Larger than Life (R5,C0,M1,S34..58,B34..45,NM); the last two need the scalar kernel" << endl;
+		cout << "\t--frame <dead|random|clipped|wrap>\tbehavior at the edges of the grid (default dead)" << endl;
+		cout << "\t--sparse\tonly recompute the tiles of the grid where something changed" << endl;
+		cout << "\t--hashlife <k>\tjumps of 2^k generations (0 <= k <= " << MAX_HASHLIFE_STEP_LOG << ") with 'h' (headless: run with HashLife only)" << endl;
+		cout << "\t--hashlife-mem <MB>\tmemory used by HashLife before its cache is cleared (default 1024)" << endl;
+		cout << "\t--headless\trun without the GUI and report the speed of the computation" << endl;
+		cout << "\t--generations <n>\tnumber of generations of a headless run (default 100)" << endl;
+		cout << "\t--temporal <k>\theadless, bit-packed: advance cache-sized blocks k generations at a time" << endl;
+		cout << "\t--verify\theadless: check the result of each run against oneGeneration" << endl;
+		cout << "\t--threads <n>\tlargest thread count of a headless run (default: <Number of threads>)" << endl;
+		cout << "\t--density <p>\tprobability that a cell of the random grid is alive (default 0.5)" << endl;
+		cout << "\t--pattern <file>\tstart from a Life pattern (RLE or plaintext) instead of a random grid" << endl;
+		cout << "\t--display <n>\tlargest number of cells drawn along a side of the grid (default 512)" << endl;
+		cout << "\t--seed <n>\tseed of the random grid and random frame (default: a random seed)" << endl;
+		cout << "\t--processes <p>x<q>\theadless: split the grid into p x q tiles computed by as many processes" << endl;
+		cout << "\t--batch <file>\trun the boards of a job file (<rule> <density> <seed> <generations> [<rows> <cols>] per line)" << endl;
+		cout << "\t--cycles <n>\tdetect a grid that repeats within n generations (headless: skip ahead)" << endl;
+		cout << "\t--stats <file>\twrite the population, births, deaths and activity of each thread at each generation (CSV)" << endl;
+		cout << "\t--checkpoint <file>\tsave the state to this file on exit (and every n generations)" << endl;
+		cout << "\t--checkpoint-every <n>\tsave a checkpoint every n generations, in the background" << endl;
+		cout << "\t--restore <file>\tstart from a checkpoint instead of a random grid, with its rule and frame behavior" << endl;
 		exit(1);
 	}
+	parseOptions(argc, argv);
+	if (statsFileName != NULL)
+	{
+		statsFile.open(statsFileName);
+		if (!statsFile)
+		{
+			cout << "Could not write the stats file " << statsFileName << endl;
+			exit(3);
+		}
+	}
+	if (!randomSeedGiven)
+	{
+		random_device randDev;
+		randomSeed = ((uint64_t) randDev() << 32) | randDev();
+		if (batchFile == NULL)
+			cout << "random seed " << randomSeed << endl;
+	}
+	//	A restored run goes on with the rule and frame behavior of the
+	//	checkpoint, so the checks below must see them
+	if (restoreFile != NULL)
+	{
+		CheckpointHeader header;
+		size_t fileSize;
+		readCheckpointHeader(restoreFile, &header, &fileSize);
+		RuleTable given, saved;
+		if (!compileRule(header.rule, &saved))
+		{
+			cout << "Invalid rule " << header.rule << " in the checkpoint" << endl;
+			exit(5);
+		}
+		if (ruleGiven && (!compileRule(ruleList[ruleListIndex].c_str(), &given) || !sameRule(&given, &saved)))
+		{
+			cout << "The checkpoint was saved with the rule " << header.rule << ", not "
+				 << ruleList[ruleListIndex] << endl;
+			exit(6);
+		}
+		if (frameGiven && frameBehavior != header.frameBehavior)
+		{
+			cout << "The checkpoint was saved with a " << frameNames[header.frameBehavior] << " frame, not "
+				 << frameNames[frameBehavior] << endl;
+			exit(6);
+		}
+		if (!ruleGiven)
+		{
+			ruleList.push_back(header.rule);
+			ruleListIndex = ruleList.size() - 1;
+		}
+		frameBehavior = header.frameBehavior;
+	}
+	if (temporalSteps != 0 && (!headlessMode || !bitPackedMode || sparseMode || hashLifeMode || frameBehavior == FRAME_RANDOM))
+	{
+		cout << "--temporal requires --headless and --bitpacked, and cannot be used with "
+			 << "--sparse, --hashlife or a random frame" << endl;
+		exit(3);
+	}
+	if (cycleHistorySize != 0 && frameBehavior == FRAME_RANDOM)
+	{
+		cout << "--cycles cannot be used with a random frame" << endl;
+		exit(3);
+	}
+	if (!compileRule(ruleList[ruleListIndex].c_str(), &activeRule))
+	{
+		cout << "Invalid rule " << ruleList[ruleListIndex] << endl;
+		exit(5);
+	}
+	if (activeRule.extended && (bitPackedMode || hashLifeMode || processRows != 0))
+	{
+		cout << "The rule " << activeRule.name << " needs the scalar kernel, and cannot be used with "
+			 << "--bitpacked, --temporal, --hashlife or --processes" << endl;
+		exit(5);
+	}
 	NUM_ROWS = numRow;
 	NUM_COLS = numCol;
 	NUM_THREADS = numThread;
+	if (patternRows > NUM_ROWS || patternCols > NUM_COLS)
+	{
+		cout << "The pattern (" << patternRows << " x " << patternCols << ") does not fit in the grid" << endl;
+		exit(7);
+	}
+
+	if (batchFile != NULL)
+	{
+		if (frameBehavior == FRAME_RANDOM)
+		{
+			cout << "--batch cannot be used with a random frame" << endl;
+			exit(3);
+		}
+		loadBatchJobs(batchFile);
+		runBatch(benchmarkThreads != 0 ? benchmarkThreads : numThread);
+		exit(0);
+	}
+
+	if (processRows != 0)
+	{
+		if (!headlessMode || sparseMode || temporalSteps != 0 || hashLifeMode || restoreFile != NULL ||
+			frameBehavior == FRAME_RANDOM || processRows > NUM_ROWS || processCols > (NUM_COLS + 63) / 64)
+		{
+			cout << "--processes requires --headless, cannot be used with --sparse, --temporal, --hashlife, "
+				 << "--restore or a random frame, and needs at least one row and 64 columns per tile" << endl;
+			exit(3);
+		}
+		runProcesses();
+		exit(0);
+	}
+
+	if (headlessMode)
+	{
+		initializeApplication(numRow, numCol);
+		startCheckpointWriter();
+		if (hashLifeMode)
+			runHashLife();
+		else
+			runBenchmark(benchmarkThreads != 0 ? benchmarkThreads : numThread);
+		stopCheckpointWriter(true);
+		unmapCheckpoint();
+		exit(0);
+	}
+
 	//	This takes care of initializing glut and the GUI.
 	//	You shouldn’t have to touch this
 	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
 	
 	//	Now we can do application-level initialization
 	initializeApplication(numRow, numCol);
+	startCheckpointWriter();
+
+	startThreads();
+
+	//	Now we enter the main loop of the program and to a large extend
+	//	"lose control" over its execution.
+	glutMainLoop();
+	deleteGrid2D(currentGrid2D);
+	deleteGrid2D(nextGrid2D);
+		
+	//	This will never be executed (the exit point will be in one of the
+	//	call back functions).
+	return 0;
+}
+
+
+//==================================================================================
+//
+//	This is a part that you have to edit and add to.
+//
+//==================================================================================
+
+void initializeApplication(unsigned int numRows, unsigned int numCols)
+{
+    //--------------------------------
+    //  Allocate the grids, with halo
+    //--------------------------------
+    currentGrid2D = newGrid2D<CellType>(numRows, numCols);
+    nextGrid2D = newGrid2D<CellType>(numRows, numCols);
+    currentGrid = currentGrid2D[-1] - 1;
+    nextGrid = nextGrid2D[-1] - 1;
+
+	//	The bit-packed grids: 2 padding words per row and 2 padding rows
+	//	(checkpoints also use this layout)
+	bitWordsPerRow = (numCols + 63) / 64 + 2;
+	if (bitPackedMode)
+	{
+		currentBits = new uint64_t[(numRows + 2) * bitWordsPerRow]();
+		nextBits = new uint64_t[(numRows + 2) * bitWordsPerRow]();
+	}
+
+	if (sparseMode)
+	{
+		numTileRows = (numRows + TILE_SIZE - 1) / TILE_SIZE;
+		numTileCols = (numCols + TILE_SIZE - 1) / TILE_SIZE;
+		tileChanged = new unsigned char[numTileRows * numTileCols]();
+		nextTileChanged = new unsigned char[numTileRows * numTileCols]();
+		dirtyTiles = new unsigned int[numTileRows * numTileCols];
+	}
+	
+	if (restoreFile != NULL)
+		restoreCheckpoint(restoreFile);
+	else
+		resetGrid();
+
+	//	The frames drawn by the front end, and the first one
+	if (!headlessMode)
+	{
+		initializeRenderFrames();
+		poolFrameRows(0, renderRows);
+		publishFrame();
+	}
+}
+
+//	Reads the optional arguments that follow <Width> <Height> <Number of threads>
+void parseOptions(int argc, const char* argv[])
+{
+	for (int k = 4; k < argc; k++)
+	{
+		if (strcmp(argv[k], "--bitpacked") == 0)
+		{
+			bitPackedMode = true;
+		}
+		else if (strcmp(argv[k], "--frame") == 0 && k+1 < argc)
+		{
+			k++;
+			for (frameBehavior = FRAME_DEAD; frameBehavior <= FRAME_WRAP; frameBehavior++)
+			{
+				if (strcmp(argv[k], frameNames[frameBehavior]) == 0)
+					break;
+			}
+			if (frameBehavior > FRAME_WRAP)
+			{
+				cout << "Unknown frame behavior " << argv[k] << endl;
+				exit(3);
+			}
+			frameGiven = true;
+		}
+		else if (strcmp(argv[k], "--sparse") == 0)
+		{
+			sparseMode = true;
+		}
+		else if (strcmp(argv[k], "--hashlife") == 0 && k+1 < argc)
+		{
+			char extra;
+			hashLifeMode = true;
+			if (sscanf(argv[++k], "%u%c", &hashLifeStepLog, &extra) != 1 || hashLifeStepLog > MAX_HASHLIFE_STEP_LOG)
+			{
+				cout << "The HashLife step must be 2^k generations with k between 0 and " << MAX_HASHLIFE_STEP_LOG << endl;
+				exit(3);
+			}
+		}
+		else if (strcmp(argv[k], "--hashlife-mem") == 0 && k+1 < argc)
+		{
+			hashMemoryCap = (uint64_t) atoi(argv[++k]) * 1024 * 1024;
+		}
+		else if (strcmp(argv[k], "--headless") == 0)
+		{
+			headlessMode = true;
+		}
+		else if (strcmp(argv[k], "--generations") == 0 && k+1 < argc)
+		{
+			lastGeneration = strtoull(argv[++k], NULL, 10);
+		}
+		else if (strcmp(argv[k], "--temporal") == 0 && k+1 < argc)
+		{
+			temporalSteps = atoi(argv[++k]);
+		}
+		else if (strcmp(argv[k], "--verify") == 0)
+		{
+			verifyMode = true;
+		}
+		else if (strcmp(argv[k], "--density") == 0 && k+1 < argc)
+		{
+			double density = atof(argv[++k]);
+			if (density < 0.0 || density > 1.0)
+			{
+				cout << "The density must be between 0 and 1" << endl;
+				exit(3);
+			}
+			densityLevel = (unsigned int) (density * 256 + 0.5);
+		}
+		else if (strcmp(argv[k], "--pattern") == 0 && k+1 < argc)
+		{
+			loadPattern(argv[++k]);
+		}
+		else if (strcmp(argv[k], "--display") == 0 && k+1 < argc)
+		{
+			displaySize = atoi(argv[++k]);
+			if (displaySize < 1)
+			{
+				cout << "The display size must be at least 1" << endl;
+				exit(3);
+			}
+		}
+		else if (strcmp(argv[k], "--seed") == 0 && k+1 < argc)
+		{
+			randomSeed = strtoull(argv[++k], NULL, 10);
+			randomSeedGiven = true;
+		}
+		else if (strcmp(argv[k], "--processes") == 0 && k+1 < argc)
+		{
+			if (sscanf(argv[++k], "%ux%u", &processRows, &processCols) != 2 || processRows < 1 || processCols < 1)
+			{
+				cout << "Invalid process grid " << argv[k] << endl;
+				exit(3);
+			}
+		}
+		else if (strcmp(argv[k], "--batch") == 0 && k+1 < argc)
+		{
+			batchFile = argv[++k];
+		}
+		else if (strcmp(argv[k], "--cycles") == 0 && k+1 < argc)
+		{
+			cycleHistorySize = atoi(argv[++k]);
+		}
+		else if (strcmp(argv[k], "--stats") == 0 && k+1 < argc)
+		{
+			statsFileName = argv[++k];
+		}
+		else if (strcmp(argv[k], "--checkpoint") == 0 && k+1 < argc)
+		{
+			checkpointFile = argv[++k];
+		}
+		else if (strcmp(argv[k], "--checkpoint-every") == 0 && k+1 < argc)
+		{
+			checkpointEvery = atoi(argv[++k]);
+		}
+		else if (strcmp(argv[k], "--restore") == 0 && k+1 < argc)
+		{
+			restoreFile = argv[++k];
+		}
+		else if (strcmp(argv[k], "--threads") == 0 && k+1 < argc)
+		{
+			benchmarkThreads = atoi(argv[++k]);
+		}
+		else if (strcmp(argv[k], "--rule") == 0 && k+1 < argc)
+		{
+			RuleTable table;
+			if (!compileRule(argv[++k], &table))
+			{
+				cout << "Invalid rule " << argv[k] << endl;
+				exit(5);
+			}
+			ruleList.push_back(argv[k]);
+			ruleListIndex = ruleList.size() - 1;
+			ruleGiven = true;
+		}
+		else
+		{
+			cout << "Unknown option " << argv[k] << endl;
+			exit(3);
+		}
+	}
+}
+
+
+//	Each thread computes its band of rows, then waits at the barrier for the
+//	other threads to be done with the same generation.  All the bands of a
+//	generation are computed concurrently.
+void* threadFunc(void* arg)
+{
+	ThreadInfo* info = (ThreadInfo*) arg;
+	double startTime = currentTime();
+
+	//	two blocks of rows for the temporal tiling
+	vector<uint64_t> scratch;
+	if (temporalSteps != 0)
+		scratch.resize(2 * TEMPORAL_CACHE_SIZE / sizeof(uint64_t) + 4 * (temporalSteps + 8) * bitWordsPerRow);
+	//	the column sums and row of the extended kernel (the rule may change)
+	vector<unsigned int> extendedScratch(EXTENDED_SCRATCH_SIZE);
+
+	//	Loop until the user hits esc
+	while(true)
+	{
+		//	the frame requested by the display, from the current grid
+		if (framePass)
+			poolFrameRows(info->threadIndex * renderRows / NUM_THREADS,
+						  (info->threadIndex + 1) * renderRows / NUM_THREADS);
+
+		if (resetPhase)
+			fillInitialRows(info -> startRow, info -> endRow, &info -> stats);
+		else if (sparseMode)
+			computeDirtyTiles(extendedScratch.data(), &info -> stats);
+		else if (temporalSteps != 0)
+			computeTemporalBand(info -> startRow, info -> endRow, scratch.data(), &info -> stats);
+		else
+			computeRows(info -> startRow, info -> endRow, extendedScratch.data(), &info -> stats);
+		double computedTime = currentTime();
+		info->busyTime += computedTime - startTime;
+
+		waitBarrier(&generationBarrier, endGeneration);
+		startTime = currentTime();
+		info->idleTime += startTime - computedTime;
+		if (stopWorkers)
+			break;
+	}
+	--numLiveThreads;
+	return NULL;
+}
+
+//	Run by the last thread to reach the barrier, while all others are
+//	blocked: this is the only place where the grids get swapped.
+void endGeneration(void)
+{
+	if (framePass)
+		publishFrame();
+	framePass = frameRequested.exchange(false);
+
+	CellStats stats;
+	collectStats(&stats);
+	if (resetPhase)
+	{
+		finishReset();
+		resetPhase = false;
+		population = stats.population;
+		lastBirths = 0;
+		lastDeaths = 0;
+		if (cycleHistorySize != 0)
+		{
+			gridHash = computeGridHash();
+			startCycleHistory();
+		}
+	}
+	else if (resetRequested)
+	{
+		//	the generation just computed is dropped, and the threads fill
+		//	the next grid instead of computing the next generation
+		resetPhase = true;
+		resetRequested = false;
+	}
+	else if (hashLifeRequested)
+	{
+		hashLifeJump();
+		hashLifeRequested = false;
+		if (cycleHistorySize != 0)
+		{
+			gridHash = computeGridHash();
+			startCycleHistory();
+		}
+	}
+	else
+	{
+		//	the grids of a previous rule are not part of a cycle
+		bool ruleChanged = rulePending;
+		generation += passSteps;
+		swapGrids();
+		population += stats.births - stats.deaths;
+		lastBirths = stats.births;
+		lastDeaths = stats.deaths;
+		gridHash ^= stats.hashChange;
+		applyPendingRule();
+		if (cycleHistorySize != 0 && ruleChanged)
+			startCycleHistory();
+		else if (cycleHistorySize != 0)
+			checkCycle();
+	}
+	//	(the counts of a dropped generation are not reported)
+	if (statsFile.is_open() && !resetPhase)
+		writeStatsLine();
+	if (colorModeRequested)
+	{
+		toggleColorMode();
+		colorModeRequested = false;
+	}
+	if (checkpointEvery != 0 && generation >= nextCheckpoint)
+	{
+		requestCheckpoint(false);
+		nextCheckpoint = generation - generation % checkpointEvery + checkpointEvery;
+	}
+	if (sparseMode)
+		buildDirtyTileList();
+	if (temporalSteps != 0)
+		passSteps = (unsigned int) min((uint64_t) temporalSteps, lastGeneration - generation);
+
+	stopWorkers = stopRequested || (lastGeneration != 0 && generation >= lastGeneration);
+	if (!stopWorkers && !headlessMode)
+		usleep(threadSleepTime);
+}
 
-	pthread_mutex_init(&lock, NULL);
-	threadInfo = new ThreadInfo[numThread];
+//	Splits the grid into NUM_THREADS bands of rows and creates one
+//	computation thread per band
+void startThreads(void)
+{
+	initBarrier(&generationBarrier, NUM_THREADS);
+	passSteps = 1;
+	if (temporalSteps != 0)
+		passSteps = (unsigned int) min((uint64_t) temporalSteps, lastGeneration - generation);
+	if (sparseMode)
+	{
+		allTilesDirty = true;
+		numDirtyTiles = 0;
+		buildDirtyTileList();
+	}
+	threadInfo = new ThreadInfo[NUM_THREADS];
+	if (statsFile.is_open())
+		writeStatsHeader();
+	if (cycleHistorySize != 0)
+	{
+		gridHash = computeGridHash();
+		startCycleHistory();
+	}
 	//Define a chunk size for a thread to work on
 	int chunkSize;
 	//Chunck divdes evenly
@@ -196,7 +1206,10 @@ int main(int argc, const char* argv[])
 		if(threadInfo[i].endRow > NUM_ROWS)
 			threadInfo[i].endRow = NUM_ROWS;
 		threadInfo[i].threadIndex = i;
-		threadInfo[i].complete = false;
+		threadInfo[i].busyTime = 0.0;
+		threadInfo[i].idleTime = 0.0;
+		memset(&threadInfo[i].stats, 0, sizeof(CellStats));
+		threadInfo[i].activity = 0;
 		++numLiveThreads;
 		int err = pthread_create(&threadInfo[i].threadID, NULL, threadFunc, threadInfo + i);
 		if(err != 0)
@@ -206,313 +1219,2695 @@ int main(int argc, const char* argv[])
 			exit(1);
 		}
 	}
-
-	//	Now we enter the main loop of the program and to a large extend
-	//	"lose control" over its execution.
-	glutMainLoop();
-	free(currentGrid2D);
-	free(currentGrid);
-		
-	//	This will never be executed (the exit point will be in one of the
-	//	call back functions).
-	return 0;
 }
 
+void joinThreads(void)
+{
+	for(unsigned int i = 0; i < NUM_THREADS; i++)
+	{
+		pthread_join(threadInfo[i].threadID, NULL);
+	}
+}
 
-//==================================================================================
-//
-//	This is a part that you have to edit and add to.
-//
-//==================================================================================
-
-void initializeApplication(unsigned int numRows, unsigned int numCols)
+//	Run by endGeneration, while the threads are blocked: adds up the counts
+//	of the generation of all the threads, and clears them for the next one
+void collectStats(CellStats* total)
 {
-    //--------------------
-    //  Allocate 1D grids
-    //--------------------
-    currentGrid = new unsigned int[numRows * numCols];
-    nextGrid = new unsigned int[numRows * numCols];
-
-    //---------------------------------------------
-    //  Scaffold 2D arrays on top of the 1D arrays
-    //---------------------------------------------
-    currentGrid2D = new unsigned int*[numRows];
-    nextGrid2D = new unsigned int*[numRows];
-    currentGrid2D[0] = currentGrid;
-    nextGrid2D[0] = nextGrid;
-    for (unsigned int i=1; i<numRows; i++)
-    {
-        currentGrid2D[i] = currentGrid2D[i-1] + numCols;
-        nextGrid2D[i] = nextGrid2D[i-1] + numCols;
-    }
-	
-	resetGrid();
+	memset(total, 0, sizeof(CellStats));
+	for (unsigned int k = 0; k < NUM_THREADS; k++)
+	{
+		CellStats* stats = &threadInfo[k].stats;
+		total->population += stats->population;
+		total->births += stats->births;
+		total->deaths += stats->deaths;
+		total->hashChange ^= stats->hashChange;
+		threadInfo[k].activity = stats->births + stats->deaths;
+		memset(stats, 0, sizeof(CellStats));
+	}
 }
 
+//	--stats: the columns of the lines written by writeStatsLine.  A new
+//	header starts each set of threads (each run of a benchmark).
+void writeStatsHeader(void)
+{
+	statsFile << "generation,population,births,deaths";
+	for (unsigned int k = 0; k < NUM_THREADS; k++)
+		statsFile << ",activity" << k;
+	statsFile << "\n";
+}
 
-void* threadFunc(void* arg)
+void writeStatsLine(void)
 {
-	ThreadInfo* info = (ThreadInfo*) arg;
+	statsFile << generation << "," << population << "," << lastBirths << "," << lastDeaths;
+	for (unsigned int k = 0; k < NUM_THREADS; k++)
+		statsFile << "," << threadInfo[k].activity;
+	statsFile << "\n";
+}
 
-	//Have threads loop infinutely to be eventually terminated when the euser hits esc
-	while(true)
+//	Number of live cells of the current grid, for when it is replaced as a
+//	whole (the kernels only count the changes)
+uint64_t countPopulation(void)
+{
+	uint64_t count = 0;
+	if (bitPackedMode)
 	{
-		//lock access
-		pthread_mutex_lock(&lock);
-		for(unsigned int i = info -> startRow; i < info -> endRow; i++)
+		unsigned int numWords = bitWordsPerRow - 2;
+		uint64_t lastWordMask = (NUM_COLS % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+		for (unsigned int i=0; i < NUM_ROWS; i++)
 		{
-			for(unsigned int j =0; j < NUM_COLS; j++)
-			{
-				//Get the new state of each cell
-				unsigned int newState = cellNewState(i, j, NUM_ROWS, NUM_COLS);
-			
-				if(colorMode == 0 || newState == 0)
-				{
-					nextGrid2D[i][j] = newState;
-				}
-				else
-				{
-					if(currentGrid2D[i][j] < NB_COLORS-1)
-						nextGrid2D[i][j] = currentGrid2D[i][j] + 1;
-					else
-						nextGrid2D[i][j] = currentGrid2D[i][j];
+			const uint64_t* row = currentBits + (i + 1) * bitWordsPerRow;
+			for (unsigned int w=1; w < numWords; w++)
+				count += __builtin_popcountll(row[w]);
+			count += __builtin_popcountll(row[numWords] & lastWordMask);
+		}
+	}
+	else
+	{
+		for (unsigned int i=0; i < NUM_ROWS; i++)
+		{
+			const CellType* row = currentGrid2D[i];
+			for (unsigned int j=0; j < NUM_COLS; j++)
+				count += (row[j] == 1);
+		}
+	}
+	return count;
+}
+
+//	Wall clock time in seconds
+double currentTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1.0E-9 * now.tv_nsec;
+}
+
+//	Runs lastGeneration generations of the same initial grid flat out with
+//	1, 2, 4, ... and finally maxThreads threads, and reports the speed of
+//	each run and its scaling relative to the single-thread run.
+void runBenchmark(unsigned int maxThreads)
+{
+	//	a restored grid starts at its own generation
+	uint64_t firstGeneration = generation;
+	uint64_t numGenerations = (lastGeneration != 0) ? lastGeneration : 100;
+	lastGeneration = firstGeneration + numGenerations;
+	if (maxThreads < 1 || maxThreads > NUM_ROWS)
+	{
+		cout << "Number of threads must be between 1 and the number of rows" << endl;
+		exit(2);
+	}
+
+	//	keep a copy of the initial grid so that every run does the same work
+	vector<CellType> initialGrid(currentGrid, currentGrid + (NUM_ROWS + 2) * (NUM_COLS + 2));
+	vector<uint64_t> initialBits;
+	if (bitPackedMode)
+		initialBits.assign(currentBits, currentBits + (NUM_ROWS + 2) * bitWordsPerRow);
+
+	//	the reference result, computed one generation at a time
+	vector<CellType> referenceGrid;
+	vector<uint64_t> referenceBits;
+	if (verifyMode)
+	{
+		for (uint64_t g=0; g < numGenerations; g++)
+			oneGeneration();
+		referenceGrid.assign(currentGrid, currentGrid + (NUM_ROWS + 2) * (NUM_COLS + 2));
+		if (bitPackedMode)
+			referenceBits.assign(currentBits, currentBits + (NUM_ROWS + 2) * bitWordsPerRow);
+	}
+
+	cout << NUM_ROWS << " x " << NUM_COLS << " grid, rule " << activeRule.name << ", "
+		 << frameNames[frameBehavior] << " frame, " << numGenerations << " generations"
+		 << (bitPackedMode ? ", bit-packed" : "");
+	if (temporalSteps != 0)
+		cout << ", temporal tiling of " << temporalSteps << " generations";
+	cout << endl;
+	cout << "threads\tseconds\tcell updates/s\tspeedup\tefficiency" << endl;
+
+	double singleThreadTime = 0.0;
+	for (unsigned int numThreads = 1; ; numThreads = min(2 * numThreads, maxThreads))
+	{
+		copy(initialGrid.begin(), initialGrid.end(), currentGrid);
+		if (bitPackedMode)
+			copy(initialBits.begin(), initialBits.end(), currentBits);
+		generation = firstGeneration;
+		nextCheckpoint = firstGeneration + checkpointEvery;
+		tilesComputed = 0;
+		//	as after a reset: the population of the copied grid, no births or deaths yet
+		population = countPopulation();
+		lastBirths = 0;
+		lastDeaths = 0;
+		NUM_THREADS = numThreads;
+
+		double startTime = currentTime();
+		startThreads();
+		joinThreads();
+		double elapsed = currentTime() - startTime;
+
+		if (numThreads == 1)
+			singleThreadTime = elapsed;
+		double speedup = singleThreadTime / elapsed;
+		cout << numThreads << "\t" << elapsed << "\t"
+			 << (double) NUM_ROWS * NUM_COLS * numGenerations / elapsed << "\t"
+			 << speedup << "\t" << speedup / numThreads << endl;
+		if (verifyMode)
+		{
+			cout << "\tresult " << (sameAsSavedGrid(referenceGrid, referenceBits) ? "identical to" : "DIFFERENT from")
+				 << " oneGeneration" << endl;
+		}
+		if (sparseMode)
+		{
+			cout << "\ttiles recomputed: " << 100.0 * tilesComputed / ((double) numGenerations * numTileRows * numTileCols)
+				 << "% per generation" << endl;
+		}
+		for (unsigned int i = 0; i < numThreads; i++)
+		{
+			cout << "\tthread " << i << ": busy " << threadInfo[i].busyTime
+				 << " s, idle " << threadInfo[i].idleTime << " s" << endl;
+		}
+		delete []threadInfo;
+
+		if (numThreads == maxThreads)
+			break;
+	}
+}
+
+//	Compares the cells of the current grid with a saved copy of the grids
+bool sameAsSavedGrid(const vector<CellType>& savedGrid, const vector<uint64_t>& savedBits)
+{
+	for (unsigned int i=0; i < NUM_ROWS; i++)
+	{
+		size_t offset = (i + 1) * bitWordsPerRow + 1;
+		if (bitPackedMode && !equal(savedBits.begin() + offset, savedBits.begin() + offset + (NUM_COLS + 63) / 64,
+									currentBits + offset))
+			return false;
+
+		offset = (i + 1) * (NUM_COLS + 2) + 1;
+		if (!bitPackedMode && !equal(savedGrid.begin() + offset, savedGrid.begin() + offset + NUM_COLS,
+									 currentGrid + offset))
+			return false;
+	}
+	return true;
+}
+
+void initBarrier(GenerationBarrier* barrier, unsigned int numThreads)
+{
+	pthread_mutex_init(&barrier->mutex, NULL);
+	pthread_cond_init(&barrier->cond, NULL);
+	barrier->numThreads = numThreads;
+	barrier->numWaiting = 0;
+	barrier->epoch = 0;
+}
+
+//	Blocks until numThreads threads have called the function.  The last
+//	thread to arrive calls lastThreadFunc (if not NULL) before releasing
+//	the others.
+void waitBarrier(GenerationBarrier* barrier, void (*lastThreadFunc)(void))
+{
+	pthread_mutex_lock(&barrier->mutex);
+	unsigned int epoch = barrier->epoch;
+	if (++barrier->numWaiting == barrier->numThreads)
+	{
+		if (lastThreadFunc != NULL)
+			lastThreadFunc();
+		barrier->numWaiting = 0;
+		barrier->epoch++;
+		pthread_cond_broadcast(&barrier->cond);
+	}
+	else
+	{
+		while (epoch == barrier->epoch)
+			pthread_cond_wait(&barrier->cond, &barrier->mutex);
+	}
+	pthread_mutex_unlock(&barrier->mutex);
+}
+
+
+void oneGeneration(void)
+{
+	static vector<unsigned int> extendedScratch;
+	extendedScratch.resize(EXTENDED_SCRATCH_SIZE);
+	CellStats stats = {0, 0, 0, 0};
+	computeRows(0, NUM_ROWS, extendedScratch.data(), &stats);
+	generation++;
+	population += stats.births - stats.deaths;
+	lastBirths = stats.births;
+	lastDeaths = stats.deaths;
+	
+	swapGrids();
+	applyPendingRule();
+	//	the tiles were not tracked
+	allTilesDirty = true;
+}
+
+//	Computes the next generation of rows [startRow, endRow) into the next grid
+void computeRows(unsigned int startRow, unsigned int endRow, unsigned int* scratch, CellStats* stats)
+{
+	computeRegion(startRow, endRow, 0, NUM_COLS, scratch, stats);
+}
+
+//	Computes the next generation of the cells of rows [startRow, endRow) and
+//	columns [startCol, endCol) into the next grid, using the bit-packed kernel
+//	when it was selected at startup.  startCol must be a multiple of 64.
+//	Returns true if any of these cells changed state, and adds the births
+//	and deaths to stats.  scratch is the calling thread's EXTENDED_SCRATCH_SIZE
+//	buffer for the extended kernel.
+bool computeRegion(unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol,
+				   unsigned int* scratch, CellStats* stats)
+{
+	if (bitPackedMode)
+	{
+		unsigned int birthMask = activeRule.birthMask,
+					 surviveMask = activeRule.surviveMask;
+		unsigned int firstWord = startCol / 64,
+					 numWords = (endCol - startCol + 63) / 64;
+		uint64_t births = 0, deaths = 0;
+		uint64_t lastWordMask = ~((uint64_t) 0);
+		if (endCol == NUM_COLS && NUM_COLS % 64 != 0)
+			lastWordMask = (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+
+		for (unsigned int i=startRow; i < endRow; i++)
+		{
+			//	row i of the grid is row i+1 of the padded bit grid
+			const uint64_t* row = currentBits + (i + 1) * bitWordsPerRow + firstWord;
+			uint64_t* out = nextBits + (i + 1) * bitWordsPerRow + firstWord;
+			bitRowNewState(row - bitWordsPerRow, row, row + bitWordsPerRow,
+						   out, numWords, birthMask, surviveMask);
+			bitFixBorder(i, startCol, endCol);
+
+			//	(the current row may hold the halo cell past the last column)
+			for (unsigned int w=1; w < numWords; w++)
+			{
+				births += __builtin_popcountll(out[w] & ~row[w]);
+				deaths += __builtin_popcountll(row[w] & ~out[w]);
+			}
+			births += __builtin_popcountll(out[numWords] & ~row[numWords] & lastWordMask);
+			deaths += __builtin_popcountll(row[numWords] & ~out[numWords] & lastWordMask);
+
+			if (cycleHistorySize != 0)
+			{
+				uint64_t index = (i + 1) * bitWordsPerRow + firstWord;
+				for (unsigned int w=1; w <= numWords; w++)
+				{
+					uint64_t mask = (w == numWords) ? lastWordMask : ~((uint64_t) 0);
+					if (((out[w] ^ row[w]) & mask) != 0)
+						stats->hashChange ^= gridWordHash(index + w, row[w] & mask) ^ gridWordHash(index + w, out[w] & mask);
 				}
 			}
 		}
-		//Reopen for access
-		pthread_mutex_unlock(&lock);
-		info->complete = true;
-		//Mark thread as complete then wait until all others are finished
-		while(info->complete)
+		stats->births += births;
+		stats->deaths += deaths;
+		return births + deaths != 0;
+	}
+
+	if (activeRule.extended)
+		return computeExtendedRegion(currentGrid2D, nextGrid2D, currentAge2D, nextAge2D,
+									 startRow, endRow, startCol, endCol, scratch, stats);
+	return computeScalarRegion(currentGrid2D, nextGrid2D, currentAge2D, nextAge2D,
+							   startRow, endRow, startCol, endCol, stats);
+}
+
+//	The scalar kernel, for any type of cell.  age2D and nextAge2D are the
+//	age planes, or NULL when not in color mode.
+template <typename CellT>
+bool computeScalarRegion(CellT** grid2D, CellT** next2D, CellT** age2D, CellT** nextAge2D,
+						 unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol,
+						 CellStats* stats)
+{
+	unsigned int birthMask = activeRule.birthMask,
+				 surviveMask = activeRule.surviveMask;
+	unsigned int changed = 0;
+	uint64_t births = 0, deaths = 0;
+
+	for (int i=startRow; i < (int) endRow; i++)
+	{
+		const CellT* above = grid2D[i-1];
+		const CellT* row = grid2D[i];
+		const CellT* below = grid2D[i+1];
+		CellT* out = next2D[i];
+
+		//	(cells are 0 or 1)
+		unsigned int rowBirths = 0, rowDeaths = 0;
+		for (int j=startCol; j < (int) endCol; j++)
+		{
+			CellT newState = cellNewState(above, row, below, j, birthMask, surviveMask);
+			out[j] = newState;
+			rowBirths += newState & (row[j] ^ 1);
+			rowDeaths += row[j] & (newState ^ 1);
+		}
+		births += rowBirths;
+		deaths += rowDeaths;
+		changed |= rowBirths | rowDeaths;
+
+		//	In color mode the color reflects the "age" of a live cell: any
+		//	cell that has not yet reached the "very old cell" stage simply
+		//	got one generation older, and an old cell remains old until it dies
+		if (age2D != NULL)
 		{
-			//just wait
-			usleep(10);
+			const CellT* age = age2D[i];
+			CellT* outAge = nextAge2D[i];
+			for (int j=startCol; j < (int) endCol; j++)
+			{
+				outAge[j] = out[j] * (age[j] + (age[j] < NB_COLORS-1));
+				changed |= outAge[j] ^ age[j];
+			}
 		}
-		//Sleep until next task
-		usleep(threadSleepTime);
+
+		if (cycleHistorySize != 0)
+			stats->hashChange ^= rowHashChange(row, out, i, startCol, endCol);
+	}
+	stats->births += births;
+	stats->deaths += deaths;
+	if (frameBehavior == FRAME_DEAD)
+	{
+		uncountDeadBorder(grid2D, next2D, startRow, endRow, startCol, endCol, stats);
+		clearDeadBorder(next2D, startRow, endRow, startCol, endCol);
+		if (nextAge2D != NULL)
+			clearDeadBorder(nextAge2D, startRow, endRow, startCol, endCol);
+	}
+	return changed != 0;
+}
+
+//	The kernel of the Larger-than-Life and Generations rules (scalar grids
+//	only).  The number of live cells in the square around each cell comes
+//	from sliding sums: colSums[k] is the number of live cells of a column in
+//	the rows [i - radius, i + radius], updated by adding a row and removing
+//	one as i moves down, and the count of a cell is the sum of 2 radius + 1
+//	of them, updated by adding a column and removing one as j moves right.
+//	So the cost of a cell does not depend on the radius.  Only the cells in
+//	state 1 are alive; the dying states of a Generations rule only age.
+//	The cells outside the grid are read according to the frame behavior, as
+//	the halo would have them, but at any distance.  The column sums and the
+//	row being loaded are kept in scratch, which the thread allocates once.
+template <typename CellT>
+bool computeExtendedRegion(CellT** grid2D, CellT** next2D, CellT** age2D, CellT** nextAge2D,
+						   unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol,
+						   unsigned int* scratch, CellStats* stats)
+{
+	const unsigned char* birthCounts = activeRule.birthCounts;
+	const unsigned char* surviveCounts = activeRule.surviveCounts;
+	int radius = activeRule.radius;
+	unsigned int numStates = activeRule.numStates,
+				 dyingState = (numStates > 2) ? 2 : 0,
+				 middle = activeRule.countMiddle ? 0 : 1;
+	unsigned int width = endCol - startCol + 2 * radius;
+	int firstCol = (int) startCol - radius;
+	unsigned int* colSums = scratch;
+	unsigned char* cells = (unsigned char*) (scratch + width);
+	memset(colSums, 0, width * sizeof(unsigned int));
+	unsigned int changed = 0;
+	uint64_t births = 0, deaths = 0;
+
+	for (int i = (int) startRow - radius; i <= (int) startRow + radius; i++)
+	{
+		loadExtendedRow(grid2D, i, firstCol, width, cells);
+		for (unsigned int k=0; k < width; k++)
+			colSums[k] += cells[k];
+	}
+
+	for (int i=startRow; i < (int) endRow; i++)
+	{
+		const CellT* row = grid2D[i];
+		CellT* out = next2D[i];
+		unsigned int sum = 0;
+		for (int k=0; k < 2 * radius; k++)
+			sum += colSums[k];
+
+		for (int j=startCol; j < (int) endCol; j++)
+		{
+			unsigned int k = j - startCol;
+			sum += colSums[k + 2 * radius];
+			unsigned int state = row[j];
+			unsigned int count = sum - middle * (state == 1);
+			if (state == 0)
+				out[j] = birthCounts[count];
+			else if (state == 1)
+				out[j] = surviveCounts[count] ? 1 : dyingState;
+			else
+				out[j] = (state + 1 < numStates) ? state + 1 : 0;
+			sum -= colSums[k];
+		}
+
+		if (frameBehavior == FRAME_DEAD)
+		{
+			if (i == 0 || i == (int) NUM_ROWS-1)
+				memset(out + startCol, 0, (endCol - startCol) * sizeof(CellT));
+			if (startCol == 0)
+				out[0] = 0;
+			if (endCol == NUM_COLS)
+				out[NUM_COLS-1] = 0;
+		}
+
+		unsigned int rowBirths = 0, rowDeaths = 0;
+		for (int j=startCol; j < (int) endCol; j++)
+		{
+			rowBirths += (out[j] == 1) & (row[j] != 1);
+			rowDeaths += (row[j] == 1) & (out[j] != 1);
+			changed |= out[j] ^ row[j];
+		}
+		births += rowBirths;
+		deaths += rowDeaths;
+
+		if (age2D != NULL)
+		{
+			const CellT* age = age2D[i];
+			CellT* outAge = nextAge2D[i];
+			for (int j=startCol; j < (int) endCol; j++)
+			{
+				outAge[j] = (out[j] == 1) * (age[j] + (age[j] < NB_COLORS-1));
+				changed |= outAge[j] ^ age[j];
+			}
+		}
+
+		if (cycleHistorySize != 0)
+			stats->hashChange ^= rowHashChange(row, out, i, startCol, endCol);
+
+		//	slide the window of rows down by one
+		if (i + 1 < (int) endRow)
+		{
+			loadExtendedRow(grid2D, i + radius + 1, firstCol, width, cells);
+			for (unsigned int k=0; k < width; k++)
+				colSums[k] += cells[k];
+			loadExtendedRow(grid2D, i - radius, firstCol, width, cells);
+			for (unsigned int k=0; k < width; k++)
+				colSums[k] -= cells[k];
+		}
+	}
+	stats->births += births;
+	stats->deaths += deaths;
+	return changed != 0;
+}
+
+//	Extended kernel: cells[k] is 1 if cell (i, firstCol + k) is alive, for k
+//	in [0, width), with the cells outside of the grid given by the frame
+//	behavior (wrapped around, random, or dead)
+template <typename CellT>
+void loadExtendedRow(CellT** grid2D, int i, int firstCol, unsigned int width, unsigned char* cells)
+{
+	bool wrap = (frameBehavior == FRAME_WRAP),
+		 random = (frameBehavior == FRAME_RANDOM);
+	bool insideRow = (i >= 0 && i < (int) NUM_ROWS);
+	if (!insideRow && wrap)
+	{
+		i = ((i % (int) NUM_ROWS) + NUM_ROWS) % NUM_ROWS;
+		insideRow = true;
+	}
+	if (!insideRow)
+	{
+		for (unsigned int k=0; k < width; k++)
+			cells[k] = random ? haloRandomCell(i, firstCol + k) : 0;
+		return;
+	}
+
+	const CellT* row = grid2D[i];
+	int start = max(firstCol, 0),
+		end = min(firstCol + (int) width, (int) NUM_COLS);
+	for (int j=start; j < end; j++)
+		cells[j - firstCol] = (row[j] == 1);
+	for (int j=firstCol; j < firstCol + (int) width; j++)
+	{
+		if (j >= 0 && j < (int) NUM_COLS)
+			continue;
+		if (wrap)
+			cells[j - firstCol] = (row[((j % (int) NUM_COLS) + NUM_COLS) % NUM_COLS] == 1);
+		else
+			cells[j - firstCol] = random ? haloRandomCell(i, j) : 0;
+	}
+}
+
+//	FRAME_DEAD: corrects the counts of the region for its cells on the border
+//	of the grid, which are about to be cleared.  A border cell computed alive
+//	was counted as a birth or a survivor, and really stays dead or dies.
+template <typename CellT>
+void uncountDeadBorder(CellT** grid2D, CellT** next2D, unsigned int startRow, unsigned int endRow,
+					   unsigned int startCol, unsigned int endCol, CellStats* stats)
+{
+	for (unsigned int i=startRow; i < endRow; i++)
+	{
+		if (i == 0 || i == NUM_ROWS-1)
+		{
+			for (unsigned int j=startCol; j < endCol; j++)
+				uncountBorderCell(grid2D[i][j], next2D[i][j], stats);
+		}
+		else
+		{
+			if (startCol == 0)
+				uncountBorderCell(grid2D[i][0], next2D[i][0], stats);
+			if (endCol == NUM_COLS)
+				uncountBorderCell(grid2D[i][NUM_COLS-1], next2D[i][NUM_COLS-1], stats);
+		}
+	}
+}
+
+template <typename CellT>
+static inline void uncountBorderCell(CellT state, CellT newState, CellStats* stats)
+{
+	if (newState != 0)
+	{
+		if (state != 0)
+			stats->deaths++;
+		else
+			stats->births--;
+	}
+}
+
+//	FRAME_DEAD: the cells on the border of the grid are kept dead.  They are
+//	computed like the others, then cleared.
+template <typename CellT>
+void clearDeadBorder(CellT** grid2D, unsigned int startRow, unsigned int endRow, unsigned int startCol, unsigned int endCol)
+{
+	if (startRow == 0)
+		memset(grid2D[0] + startCol, 0, (endCol - startCol) * sizeof(CellT));
+	if (endRow == NUM_ROWS)
+		memset(grid2D[NUM_ROWS-1] + startCol, 0, (endCol - startCol) * sizeof(CellT));
+	for (unsigned int i=startRow; i < endRow; i++)
+	{
+		if (startCol == 0)
+			grid2D[i][0] = 0;
+		if (endCol == NUM_COLS)
+			grid2D[i][NUM_COLS-1] = 0;
+	}
+}
+
+//	Cycle detection: the hash of a word of cells at a given position
+static inline uint64_t gridWordHash(uint64_t index, uint64_t word)
+{
+	return randomHash(index, word);
+}
+
+//	The cells [j, j + 8/sizeof(CellT)) of a row of a scalar grid as a word,
+//	without the cells past the last column.  j is a multiple of the number
+//	of cells of a word.
+template <typename CellT>
+static inline uint64_t cellWord(const CellT* row, unsigned int j)
+{
+	const unsigned int wordCells = sizeof(uint64_t) / sizeof(CellT);
+	uint64_t word;
+	memcpy(&word, row + j, sizeof(uint64_t));
+	if (j + wordCells > NUM_COLS)
+		word &= ~((uint64_t) 0) >> (64 - 8 * sizeof(CellT) * (NUM_COLS - j));
+	return word;
+}
+
+//	Cycle detection: the change of the grid hash for the cells of row i in
+//	columns [startCol, endCol), from row to out.  With a dead frame, the
+//	border cells are hashed dead, as they will be once cleared.
+template <typename CellT>
+uint64_t rowHashChange(const CellT* row, const CellT* out, unsigned int i, unsigned int startCol, unsigned int endCol)
+{
+	const unsigned int wordCells = sizeof(uint64_t) / sizeof(CellT);
+	uint64_t cellMask = ~((uint64_t) 0) >> (64 - 8 * sizeof(CellT));
+	uint64_t index = (uint64_t) i * ((NUM_COLS + wordCells - 1) / wordCells);
+	uint64_t change = 0;
+
+	for (unsigned int j=startCol; j < endCol; j += wordCells)
+	{
+		uint64_t before = cellWord(row, j),
+				 after = cellWord(out, j);
+		if (frameBehavior == FRAME_DEAD)
+		{
+			if (i == 0 || i == NUM_ROWS-1)
+				after = 0;
+			if (j == 0)
+				after &= ~cellMask;
+			if (j + wordCells >= NUM_COLS)
+				after &= ~(cellMask << (8 * sizeof(CellT) * (NUM_COLS-1 - j)));
+		}
+		if (before != after)
+			change ^= gridWordHash(index + j / wordCells, before) ^ gridWordHash(index + j / wordCells, after);
+	}
+	return change;
+}
+
+//	Cycle detection: the hash of the whole current grid, for when it is
+//	replaced (the kernels only hash the changes)
+uint64_t computeGridHash(void)
+{
+	uint64_t hash = 0;
+	if (bitPackedMode)
+	{
+		unsigned int numWords = bitWordsPerRow - 2;
+		uint64_t lastWordMask = (NUM_COLS % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+		for (unsigned int i=0; i < NUM_ROWS; i++)
+		{
+			const uint64_t* row = currentBits + (i + 1) * bitWordsPerRow;
+			for (unsigned int w=1; w <= numWords; w++)
+				hash ^= gridWordHash((i + 1) * bitWordsPerRow + w, (w == numWords) ? row[w] & lastWordMask : row[w]);
+		}
+	}
+	else
+	{
+		const unsigned int wordCells = sizeof(uint64_t) / sizeof(CellType);
+		uint64_t wordsPerRow = (NUM_COLS + wordCells - 1) / wordCells;
+		for (unsigned int i=0; i < NUM_ROWS; i++)
+		{
+			for (unsigned int j=0; j < NUM_COLS; j += wordCells)
+				hash ^= gridWordHash(i * wordsPerRow + j / wordCells, cellWord(currentGrid2D[i], j));
+		}
+	}
+	return hash;
+}
+
+//	Cycle detection: forgets the previous grids, and starts a new history
+//	with the current one
+void startCycleHistory(void)
+{
+	cycleHashes.assign(1, gridHash);
+	cycleGenerations.assign(1, generation);
+	cycleNext = 1 % cycleHistorySize;
+	cyclePeriod = 0;
+}
+
+//	Run by endGeneration: looks for the current grid in the history, then
+//	adds it.  In a headless run, a grid seen p generations ago will repeat
+//	every p generations, so the run can skip a multiple of p generations.
+void checkCycle(void)
+{
+	for (unsigned int k = 0; k < cycleHashes.size(); k++)
+	{
+		if (cycleHashes[k] != gridHash)
+			continue;
+		unsigned int period = (unsigned int) (generation - cycleGenerations[k]);
+		if (cyclePeriod != period)
+		{
+			cyclePeriod = period;
+			cout << "generation " << generation << ": the grid repeats every " << period << " generations" << endl;
+		}
+		if (headlessMode && lastGeneration > generation)
+		{
+			uint64_t skip = (lastGeneration - generation) / period * period;
+			if (skip != 0)
+			{
+				generation += skip;
+				cout << "\tskipped to generation " << generation << endl;
+				startCycleHistory();
+				cyclePeriod = period;
+				return;
+			}
+		}
+		break;
+	}
+
+	if (cycleHashes.size() < cycleHistorySize)
+	{
+		cycleHashes.push_back(gridHash);
+		cycleGenerations.push_back(generation);
+	}
+	else
+	{
+		cycleHashes[cycleNext] = gridHash;
+		cycleGenerations[cycleNext] = generation;
+	}
+	cycleNext = (cycleNext + 1) % cycleHistorySize;
+}
+
+//	Sparse mode: computes tiles of the dirty list until there are none left
+void computeDirtyTiles(unsigned int* scratch, CellStats* stats)
+{
+	for (unsigned int k = nextDirtyTile++; k < numDirtyTiles; k = nextDirtyTile++)
+	{
+		unsigned int tile = dirtyTiles[k],
+					 startRow = (tile / numTileCols) * TILE_SIZE,
+					 startCol = (tile % numTileCols) * TILE_SIZE;
+		nextTileChanged[tile] = computeRegion(startRow, min(startRow + TILE_SIZE, NUM_ROWS),
+											  startCol, min(startCol + TILE_SIZE, NUM_COLS), scratch, stats);
+	}
+}
+
+//	Temporal tiling: advances rows [startRow, endRow) of the current bit grid
+//	by passSteps generations into the next bit grid, one cache-sized block
+//	of rows at a time.  scratch holds two blocks of rows.  The births and
+//	deaths are those of the whole pass, from the first to the last grid.
+void computeTemporalBand(unsigned int startRow, unsigned int endRow, uint64_t* scratch, CellStats* stats)
+{
+	unsigned int steps = passSteps;
+	unsigned int rowSize = bitWordsPerRow,
+				 numWords = bitWordsPerRow - 2;
+	unsigned int blockRows = TEMPORAL_CACHE_SIZE / (2 * rowSize * sizeof(uint64_t));
+	blockRows = (blockRows > 2 * steps + 8) ? blockRows - 2 * steps : 8;
+	bool wrap = (frameBehavior == FRAME_WRAP);
+	uint64_t lastWordMask = (NUM_COLS % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+
+	for (unsigned int r0=startRow; r0 < endRow; r0 += blockRows)
+	{
+		unsigned int r1 = min(r0 + blockRows, endRow);
+		//	local row l of the block is row r0 - steps + l of the grid
+		unsigned int height = r1 - r0 + 2 * steps;
+		uint64_t* src = scratch;
+		uint64_t* dst = scratch + height * rowSize;
+		int firstRow = (int) r0 - (int) steps;
+
+		for (unsigned int l=0; l < height; l++)
+		{
+			int g = firstRow + (int) l;
+			if (wrap)
+				g = ((g % (int) NUM_ROWS) + NUM_ROWS) % NUM_ROWS;
+			if (g < 0 || g >= (int) NUM_ROWS)
+				memset(src + l * rowSize, 0, rowSize * sizeof(uint64_t));
+			else
+				memcpy(src + l * rowSize, currentBits + (g + 1) * rowSize, rowSize * sizeof(uint64_t));
+		}
+
+		//	at step s, the rows that can still be computed exactly are
+		//	those at least s rows away from the edges of the block
+		for (unsigned int step=1; step <= steps; step++)
+		{
+			for (unsigned int l=step; l < height - step; l++)
+			{
+				uint64_t* out = dst + l * rowSize;
+				int g = firstRow + (int) l;
+				if (!wrap && (g < 0 || g >= (int) NUM_ROWS))
+				{
+					//	outside the grid: stays a row of dead halo cells
+					memset(out, 0, rowSize * sizeof(uint64_t));
+					continue;
+				}
+				bitRowNewState(src + (l - 1) * rowSize, src + l * rowSize, src + (l + 1) * rowSize,
+							   out, numWords, activeRule.birthMask, activeRule.surviveMask);
+				out[0] = 0;
+				out[numWords + 1] = 0;
+				out[numWords] &= lastWordMask;
+
+				if (frameBehavior == FRAME_DEAD)
+				{
+					if (g == 0 || g == (int) NUM_ROWS-1)
+						memset(out + 1, 0, numWords * sizeof(uint64_t));
+					out[1] &= ~((uint64_t) 1);
+					out[1 + (NUM_COLS-1) / 64] &= ~(((uint64_t) 1) << ((NUM_COLS-1) % 64));
+				}
+				else if (wrap)
+				{
+					//	the halo cells of the row, as in fillHalo
+					if ((out[1 + (NUM_COLS-1) / 64] >> ((NUM_COLS-1) % 64)) & 1)
+						out[0] = ((uint64_t) 1) << 63;
+					out[1 + NUM_COLS / 64] |= (out[1] & 1) << (NUM_COLS % 64);
+				}
+			}
+			uint64_t* temp = src;
+			src = dst;
+			dst = temp;
+		}
+
+		for (unsigned int i=r0; i < r1; i++)
+		{
+			const uint64_t* row = currentBits + (i + 1) * rowSize;
+			const uint64_t* out = src + (i - firstRow) * rowSize;
+			for (unsigned int w=1; w <= numWords; w++)
+			{
+				uint64_t mask = (w == numWords) ? lastWordMask : ~((uint64_t) 0);
+				stats->births += __builtin_popcountll(out[w] & ~row[w] & mask);
+				stats->deaths += __builtin_popcountll(row[w] & ~out[w] & mask);
+				if (cycleHistorySize != 0 && ((out[w] ^ row[w]) & mask) != 0)
+					stats->hashChange ^= gridWordHash((i + 1) * rowSize + w, row[w] & mask) ^
+										 gridWordHash((i + 1) * rowSize + w, out[w] & mask);
+			}
+			memcpy(nextBits + (i + 1) * rowSize, out, rowSize * sizeof(uint64_t));
+		}
+	}
+}
+
+//	Sparse mode: called between two generations to make the list of the
+//	tiles to compute in the next generation.  A tile is dirty if it or one
+//	of its eight neighbor tiles changed during the generation just computed.
+//	A Larger-than-Life radius is at most MAX_RULE_RADIUS < TILE_SIZE cells,
+//	so the neighbor tiles are enough, except across a last tile narrower
+//	than the radius: then the tiles two away are neighbors too.
+void buildDirtyTileList(void)
+{
+	//	the tiles of the list that was just computed
+	tilesComputed += numDirtyTiles;
+
+	unsigned char* temp = tileChanged;
+	tileChanged = nextTileChanged;
+	nextTileChanged = temp;
+
+	//	with a B0 rule, dead cells far from anything alive can be born
+	bool allDirty = allTilesDirty || activeRule.birthCounts[0] != 0;
+	allTilesDirty = false;
+
+	//	with a wrapped frame, the tiles on an edge are neighbors of the tiles
+	//	on the opposite edge
+	bool wrap = (frameBehavior == FRAME_WRAP);
+
+	unsigned int lastTileRows = (NUM_ROWS % TILE_SIZE == 0) ? TILE_SIZE : NUM_ROWS % TILE_SIZE,
+				 lastTileCols = (NUM_COLS % TILE_SIZE == 0) ? TILE_SIZE : NUM_COLS % TILE_SIZE;
+	int rowReach = (activeRule.radius > lastTileRows) ? 2 : 1,
+		colReach = (activeRule.radius > lastTileCols) ? 2 : 1;
+
+	numDirtyTiles = 0;
+	for (unsigned int tr=0; tr < numTileRows; tr++)
+	{
+		for (unsigned int tc=0; tc < numTileCols; tc++)
+		{
+			//	with a random frame, the border cells get new random neighbors
+			//	at every generation
+			bool dirty = allDirty || (frameBehavior == FRAME_RANDOM &&
+						 ((int) tr < rowReach || (int) tr >= (int) numTileRows - rowReach ||
+						  (int) tc < colReach || (int) tc >= (int) numTileCols - colReach));
+
+			for (int dr = -rowReach; !dirty && dr <= rowReach; dr++)
+			{
+				int r = (int) tr + dr;
+				if (wrap)
+					r = (r + numTileRows) % numTileRows;
+				if (r < 0 || r >= (int) numTileRows)
+					continue;
+				for (int dc = -colReach; !dirty && dc <= colReach; dc++)
+				{
+					int c = (int) tc + dc;
+					if (wrap)
+						c = (c + numTileCols) % numTileCols;
+					if (c >= 0 && c < (int) numTileCols)
+						dirty = tileChanged[r * numTileCols + c] != 0;
+				}
+			}
+
+			nextTileChanged[tr * numTileCols + tc] = 0;
+			if (dirty)
+				dirtyTiles[numDirtyTiles++] = tr * numTileCols + tc;
+		}
+	}
+	nextDirtyTile = 0;
+}
+
+//	This is the function that determines how a cell update its state.
+//	Thanks to the halo, every cell of the grid has eight neighbors to read,
+//	so there is no test on the position of the cell and the loop that calls
+//	this function can be vectorized.
+template <typename CellT>
+static inline unsigned int cellNewState(const CellT* above, const CellT* row, const CellT* below, int j,
+										unsigned int birthMask, unsigned int surviveMask)
+{
+	//	First count the number of neighbors that are alive.  The state grids
+	//	only hold 0s and 1s (the age is in its own plane), so we simply add
+	unsigned int count = above[j-1] + above[j] + above[j+1] +
+						 row[j-1] + row[j+1] +
+						 below[j-1] + below[j] + below[j+1];
+
+	//	Next apply the cellular automaton rule: look at the "Stay alive" set
+	//	for a live cell, at the "Birth of a new cell" set for an empty square
+	unsigned int mask = (row[j] != 0) ? surviveMask : birthMask;
+	return (mask >> count) & 1;
+}
+
+//	Counter-based random numbers (the SplitMix64 generator, evaluated at
+//	position counter of the stream that starts at key)
+static inline uint64_t randomHash(uint64_t key, uint64_t counter)
+{
+	uint64_t z = key + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//	A word of 64 random cells, each alive with probability level/256.
+//	Going through the bits of level from the lowest set one, the word is
+//	combined with a new random word: OR for a 1 (p -> (1 + p)/2), AND for
+//	a 0 (p -> p/2).  For the default density, that is a single random word.
+static inline uint64_t randomDensityWord(uint64_t key, uint64_t counter, unsigned int level)
+{
+	if (level == 0 || level >= 256)
+		return (level == 0) ? 0 : ~((uint64_t) 0);
+	uint64_t word = 0;
+	for (unsigned int b = __builtin_ctz(level); b < 8; b++)
+	{
+		uint64_t random = randomHash(key, 8 * counter + b);
+		word = ((level >> b) & 1) ? (word | random) : (word & random);
+	}
+	return word;
+}
+
+//	FRAME_RANDOM: the state of halo cell (i, j) at the current generation.
+//	The extended kernel reads up to MAX_RULE_RADIUS cells outside the grid,
+//	so each generation has a counter for every cell of that wider square.
+static inline unsigned int haloRandomCell(int i, int j)
+{
+	uint64_t cell = (uint64_t) (i + MAX_RULE_RADIUS) * (NUM_COLS + 2 * MAX_RULE_RADIUS) + (j + MAX_RULE_RADIUS);
+	uint64_t counter = (uint64_t) generation * (NUM_ROWS + 2 * MAX_RULE_RADIUS) * (NUM_COLS + 2 * MAX_RULE_RADIUS) + cell;
+	return randomHash(randomHash(randomSeed, RANDOM_STREAM_FRAME), counter) >> 63;
+}
+
+//	Fills the halo of the current grid (and current bit grid) according to
+//	the frame behavior.  Called each time a new current grid is installed.
+void fillHalo(void)
+{
+	if (bitPackedMode)
+	{
+		unsigned int rightWord = 1 + NUM_COLS / 64;
+		uint64_t rightBit = ((uint64_t) 1) << (NUM_COLS % 64);
+		const uint64_t leftBit = ((uint64_t) 1) << 63;
+
+		for (unsigned int i=0; i < NUM_ROWS; i++)
+		{
+			uint64_t* row = currentBits + (i + 1) * bitWordsPerRow;
+			bool left = false, right = false;
+			if (frameBehavior == FRAME_WRAP)
+			{
+				left = (row[1 + (NUM_COLS-1) / 64] >> ((NUM_COLS-1) % 64)) & 1;
+				right = row[1] & 1;
+			}
+			else if (frameBehavior == FRAME_RANDOM)
+			{
+				left = haloRandomCell(i, -1);
+				right = haloRandomCell(i, NUM_COLS);
+			}
+			row[0] = left ? leftBit : 0;
+			row[rightWord] = right ? (row[rightWord] | rightBit) : (row[rightWord] & ~rightBit);
+		}
+
+		//	the halo rows, corners included
+		uint64_t* top = currentBits;
+		uint64_t* bottom = currentBits + (NUM_ROWS + 1) * bitWordsPerRow;
+		size_t rowSize = bitWordsPerRow * sizeof(uint64_t);
+		if (frameBehavior == FRAME_WRAP)
+		{
+			memcpy(top, bottom - bitWordsPerRow, rowSize);
+			memcpy(bottom, top + bitWordsPerRow, rowSize);
+		}
+		else if (frameBehavior == FRAME_RANDOM)
+		{
+			//	same cells as in the scalar grid
+			memset(top, 0, rowSize);
+			memset(bottom, 0, rowSize);
+			for (int j=0; j <= (int) NUM_COLS; j++)
+			{
+				uint64_t bit = ((uint64_t) 1) << (j % 64);
+				top[1 + j/64] |= haloRandomCell(-1, j) ? bit : 0;
+				bottom[1 + j/64] |= haloRandomCell(NUM_ROWS, j) ? bit : 0;
+			}
+			top[0] = haloRandomCell(-1, -1) ? leftBit : 0;
+			bottom[0] = haloRandomCell(NUM_ROWS, -1) ? leftBit : 0;
+		}
+		else
+		{
+			memset(top, 0, rowSize);
+			memset(bottom, 0, rowSize);
+		}
+		return;
+	}
+
+	for (unsigned int i=0; i < NUM_ROWS; i++)
+	{
+		CellType* row = currentGrid2D[i];
+		switch (frameBehavior)
+		{
+			case FRAME_WRAP:
+				row[-1] = row[NUM_COLS-1];
+				row[NUM_COLS] = row[0];
+				break;
+
+			case FRAME_RANDOM:
+				row[-1] = haloRandomCell(i, -1);
+				row[NUM_COLS] = haloRandomCell(i, NUM_COLS);
+				break;
+
+			default:
+				row[-1] = row[NUM_COLS] = 0;
+				break;
+		}
+	}
+
+	//	the halo rows, corners included
+	CellType* top = currentGrid2D[-1] - 1;
+	CellType* bottom = currentGrid2D[NUM_ROWS] - 1;
+	size_t rowSize = (NUM_COLS + 2) * sizeof(CellType);
+	if (frameBehavior == FRAME_WRAP)
+	{
+		memcpy(top, currentGrid2D[NUM_ROWS-1] - 1, rowSize);
+		memcpy(bottom, currentGrid2D[0] - 1, rowSize);
+	}
+	else if (frameBehavior == FRAME_RANDOM)
+	{
+		for (int j=-1; j <= (int) NUM_COLS; j++)
+		{
+			top[j+1] = haloRandomCell(-1, j);
+			bottom[j+1] = haloRandomCell(NUM_ROWS, j);
+		}
+	}
+	else
+	{
+		memset(top, 0, rowSize);
+		memset(bottom, 0, rowSize);
+	}
+}
+
+
+#if 0
+//==================================================================================
+#pragma mark -
+#pragma mark Rule compiler
+//==================================================================================
+#endif
+
+//	Compiles a rulestring into a rule table.  Accepts
+//		- Life-like rules, in the B/S notation in either order and any case
+//		  ("B3/S23", "s23/b3") or the plain survival/birth notation ("23/3")
+//		- Generations rules, the same with a number of states ("B2/S/C3",
+//		  or "/2/3" as survival/birth/states)
+//		- Larger-than-Life rules, in the notation "R5,C0,M1,S34..58,B34..45,NM"
+//		  (radius, states (0 for 2), middle cell counted, survival and birth
+//		  ranges, Moore neighborhood)
+//	Returns false if the string is not a valid rule.
+bool compileRule(const char* ruleString, RuleTable* table)
+{
+	if (strlen(ruleString) >= sizeof(table->name))
+		return false;
+	memset(table, 0, sizeof(RuleTable));
+	strcpy(table->name, ruleString);
+	table->radius = 1;
+	table->numStates = 2;
+
+	bool valid = (ruleString[0] == 'R' || ruleString[0] == 'r') && strchr(ruleString, ',') != NULL
+					? compileLargerThanLifeRule(ruleString, table)
+					: compileLifeRule(ruleString, table);
+	if (!valid)
+		return false;
+
+	for (unsigned int k=0; k <= 8; k++)
+	{
+		table->birthMask |= (unsigned int) table->birthCounts[k] << k;
+		table->surviveMask |= (unsigned int) table->surviveCounts[k] << k;
+	}
+	table->extended = (table->radius > 1 || table->numStates > 2 || table->countMiddle);
+	return true;
+}
+
+//	The Life-like and Generations notations
+bool compileLifeRule(const char* ruleString, RuleTable* table)
+{
+	//	counts[0] is the birth set, counts[1] the survival set
+	unsigned char* counts[2] = {table->birthCounts, table->surviveCounts};
+	bool hasLetters = strpbrk(ruleString, "BbSsCc") != NULL;
+	int section = hasLetters ? -1 : 1;
+	unsigned int numSlashes = 0, numStates = 0;
+
+	for (const char* c = ruleString; *c != '\0'; c++)
+	{
+		if (*c == 'B' || *c == 'b')
+			section = 0;
+		else if (*c == 'S' || *c == 's')
+			section = 1;
+		else if (*c == 'C' || *c == 'c')
+			section = 2;
+		else if (*c == '/')
+		{
+			if (!hasLetters)
+				section = (++numSlashes == 1) ? 0 : 2;
+			if (numSlashes > 2)
+				return false;
+		}
+		else if (*c >= '0' && *c <= '8' && (section == 0 || section == 1))
+			counts[section][*c - '0'] = 1;
+		else if (*c >= '0' && *c <= '9' && section == 2 && numStates < 256)
+			numStates = 10 * numStates + (*c - '0');
+		else
+			return false;
+	}
+	if (section == 2 || numSlashes == 2)
+	{
+		//	the states must fit in a cell
+		if (numStates < 2 || numStates > 255)
+			return false;
+		table->numStates = numStates;
+	}
+	return true;
+}
+
+//	The Larger-than-Life notation
+bool compileLargerThanLifeRule(const char* ruleString, RuleTable* table)
+{
+	unsigned int maxCount = MAX_RULE_COUNT;
+	string field;
+	stringstream fields(ruleString);
+	while (getline(fields, field, ','))
+	{
+		unsigned int first, last, value;
+		char extra;
+		if (field.size() < 2)
+			return false;
+		const char* text = field.c_str() + 1;
+		switch (field[0])
+		{
+			case 'R': case 'r':
+				if (sscanf(text, "%u%c", &value, &extra) != 1 || value < 1 || value > MAX_RULE_RADIUS)
+					return false;
+				table->radius = value;
+				maxCount = (2 * value + 1) * (2 * value + 1);
+				break;
+
+			case 'C': case 'c':
+				if (sscanf(text, "%u%c", &value, &extra) != 1 || value > 255)
+					return false;
+				table->numStates = max(value, 2U);
+				break;
+
+			case 'M': case 'm':
+				if (sscanf(text, "%u%c", &value, &extra) != 1 || value > 1)
+					return false;
+				table->countMiddle = (value == 1);
+				break;
+
+			case 'S': case 's':
+			case 'B': case 'b':
+				if (sscanf(text, "%u..%u%c", &first, &last, &extra) != 2)
+				{
+					if (sscanf(text, "%u%c", &first, &extra) != 1)
+						return false;
+					last = first;
+				}
+				if (first > last || last > MAX_RULE_COUNT)
+					return false;
+				for (unsigned int k=first; k <= last; k++)
+				{
+					if (field[0] == 'B' || field[0] == 'b')
+						table->birthCounts[k] = 1;
+					else
+						table->surviveCounts[k] = 1;
+				}
+				break;
+
+			case 'N': case 'n':
+				//	only the Moore (square) neighborhood
+				if (field != "NM" && field != "nm")
+					return false;
+				break;
+
+			default:
+				return false;
+		}
+	}
+	//	no count beyond the size of the neighborhood
+	for (unsigned int k=maxCount + 1; k <= MAX_RULE_COUNT; k++)
+	{
+		if (table->birthCounts[k] || table->surviveCounts[k])
+			return false;
+	}
+	return true;
+}
+
+//	Two compiled rules are the same if they give every cell the same next
+//	state, whatever they are called ("B3/S23" and "23/3" are the same rule).
+bool sameRule(const RuleTable* a, const RuleTable* b)
+{
+	return a->birthMask == b->birthMask && a->surviveMask == b->surviveMask &&
+		   a->radius == b->radius && a->numStates == b->numStates &&
+		   a->countMiddle == b->countMiddle && a->extended == b->extended &&
+		   memcmp(a->birthCounts, b->birthCounts, sizeof(a->birthCounts)) == 0 &&
+		   memcmp(a->surviveCounts, b->surviveCounts, sizeof(a->surviveCounts)) == 0;
+}
+
+//	Compiles the rule at position index of ruleList.  It will be applied at
+//	the end of the current generation.
+void selectRule(unsigned int index)
+{
+	ruleListIndex = index;
+	if (compileRule(ruleList[index].c_str(), &pendingRule))
+	{
+		if (pendingRule.extended && bitPackedMode)
+		{
+			cout << "Rule " << pendingRule.name << " needs the scalar kernel" << endl;
+			return;
+		}
+		rulePending = true;
+		cout << "Rule " << pendingRule.name << endl;
+	}
+}
+
+//	Called between two generations, when no thread is reading the rule, on
+//	the current grid.  The cells in a state that the new rule does not have
+//	(the dying states of a Generations rule) die.
+void applyPendingRule(void)
+{
+	if (rulePending)
+	{
+		bool fewerStates = pendingRule.numStates < activeRule.numStates;
+		activeRule = pendingRule;
+		rulePending = false;
+		allTilesDirty = true;
+		if (fewerStates && !bitPackedMode)
+		{
+			for (unsigned int i=0; i < NUM_ROWS; i++)
+			{
+				CellType* row = currentGrid2D[i];
+				for (unsigned int j=0; j < NUM_COLS; j++)
+					row[j] = (row[j] < activeRule.numStates) ? row[j] : 0;
+			}
+			fillHalo();
+			population = countPopulation();
+			gridHash = computeGridHash();
+		}
+	}
+}
+
+
+#if 0
+//==================================================================================
+#pragma mark -
+#pragma mark Bit-packed kernel
+//==================================================================================
+#endif
+
+//	Bit-sliced full adder: adds three 64-lane one-bit values
+static inline void fullAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t& sum, uint64_t& carry)
+{
+	uint64_t t = a ^ b;
+	sum = t ^ c;
+	carry = (a & b) | (t & c);
+}
+
+//	Computes 64 cells at a time (SIMD within a register).  The eight neighbor
+//	bits of every cell in a word are added in parallel into a 4-bit count
+//	(s3 s2 s1 s0), then the count is compared against the count masks of the
+//	compiled rule.
+//	The row pointers point at the left padding word of their row, and
+//	numWords is the number of data words in the row.
+void bitRowNewState(const uint64_t* above, const uint64_t* row, const uint64_t* below,
+					uint64_t* out, unsigned int numWords, unsigned int birthMask, unsigned int surviveMask)
+{
+	for (unsigned int w=1; w <= numWords; w++)
+	{
+		//	neighbors to the west of each cell (column j-1) shifted into
+		//	position j, and to the east (column j+1) likewise
+		uint64_t aW = (above[w] << 1) | (above[w-1] >> 63),
+				 aE = (above[w] >> 1) | (above[w+1] << 63),
+				 bW = (row[w] << 1) | (row[w-1] >> 63),
+				 bE = (row[w] >> 1) | (row[w+1] << 63),
+				 cW = (below[w] << 1) | (below[w-1] >> 63),
+				 cE = (below[w] >> 1) | (below[w+1] << 63);
+
+		//	adder tree for the 8 neighbors
+		uint64_t sA, cA, sB, cB, s0, c1, t0, t1;
+		fullAdd(aW, above[w], aE, sA, cA);
+		fullAdd(bW, bE, cW, sB, cB);
+		uint64_t sC = below[w] ^ cE,
+				 cC = below[w] & cE;
+		fullAdd(sA, sB, sC, s0, c1);
+		fullAdd(cA, cB, cC, t0, t1);
+		uint64_t s1 = t0 ^ c1,
+				 t2 = t0 & c1,
+				 s2 = t1 ^ t2,
+				 s3 = t1 & t2;
+
+		//	select the lanes whose count is in the birth or the survival set
+		uint64_t born = 0, survive = 0;
+		for (unsigned int k=0; k <= 8; k++)
+		{
+			if (((birthMask | surviveMask) & (1 << k)) == 0)
+				continue;
+
+			uint64_t eq = ((k & 1) ? s0 : ~s0) &
+						  ((k & 2) ? s1 : ~s1) &
+						  ((k & 4) ? s2 : ~s2) &
+						  ((k & 8) ? s3 : ~s3);
+			if (birthMask & (1 << k))
+				born |= eq;
+			if (surviveMask & (1 << k))
+				survive |= eq;
+		}
+		out[w] = (row[w] & survive) | (~row[w] & born);
+	}
+}
+
+//	Clears the bits past the last column of row i of the next bit grid and,
+//	with FRAME_DEAD, the border cells of that row that are in columns
+//	[startCol, endCol).  startCol must be a multiple of 64.
+void bitFixBorder(unsigned int i, unsigned int startCol, unsigned int endCol)
+{
+	uint64_t* out = nextBits + (i + 1) * bitWordsPerRow;
+	unsigned int numWords = bitWordsPerRow - 2;
+	
+	if (endCol == NUM_COLS && NUM_COLS % 64 != 0)
+		out[numWords] &= (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+
+	if (frameBehavior == FRAME_DEAD)
+	{
+		if (i == 0 || i == NUM_ROWS-1)
+		{
+			for (unsigned int w=1 + startCol/64; w <= 1 + (endCol-1)/64; w++)
+				out[w] = 0;
+		}
+		else
+		{
+			if (startCol == 0)
+				out[1] &= ~((uint64_t) 1);
+			if (endCol == NUM_COLS)
+				out[1 + (NUM_COLS-1) / 64] &= ~(((uint64_t) 1) << ((NUM_COLS-1) % 64));
+		}
+	}
+}
+
+//	Copies a grid into a bit-packed grid (any non-zero value is alive)
+template <typename CellT>
+void packGrid(CellT** grid, uint64_t* bits)
+{
+	for (unsigned int i=0; i < NUM_ROWS; i++)
+	{
+		uint64_t* row = bits + (i + 1) * bitWordsPerRow;
+		for (unsigned int w=1; w < bitWordsPerRow-1; w++)
+			row[w] = 0;
+		for (unsigned int j=0; j < NUM_COLS; j++)
+		{
+			if (grid[i][j] != 0)
+				row[1 + j/64] |= ((uint64_t) 1) << (j % 64);
+		}
+	}
+}
+
+//	Expands a bit-packed grid into a grid of 0s and 1s
+template <typename CellT>
+void unpackGrid(const uint64_t* bits, CellT** grid)
+{
+	for (unsigned int i=0; i < NUM_ROWS; i++)
+	{
+		const uint64_t* row = bits + (i + 1) * bitWordsPerRow;
+		for (unsigned int j=0; j < NUM_COLS; j++)
+			grid[i][j] = (row[1 + j/64] >> (j % 64)) & 1;
+	}
+}
+
+#if 0
+//==================================================================================
+#pragma mark -
+#pragma mark HashLife engine
+//==================================================================================
+#endif
+
+static inline size_t hashLifeHash(HashNode* nw, HashNode* ne, HashNode* sw, HashNode* se)
+{
+	uint64_t h = (uintptr_t) nw;
+	h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t) ne;
+	h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t) sw;
+	h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t) se;
+	return (size_t) (h ^ (h >> 29));
+}
+
+//	Returns the canonical node with these four children, creating it if needed
+HashNode* hashLifeNode(HashNode* nw, HashNode* ne, HashNode* sw, HashNode* se)
+{
+	if (hashTable.empty())
+		hashTable.assign(1 << 16, NULL);
+
+	size_t bucket = hashLifeHash(nw, ne, sw, se) & (hashTable.size() - 1);
+	for (HashNode* node = hashTable[bucket]; node != NULL; node = node->next)
+	{
+		if (node->nw == nw && node->ne == ne && node->sw == sw && node->se == se)
+			return node;
+	}
+
+	HashNode* node = new HashNode;
+	node->nw = nw;
+	node->ne = ne;
+	node->sw = sw;
+	node->se = se;
+	node->result = NULL;
+	node->stepResult = NULL;
+	node->stepLog = 0;
+	node->marked = false;
+	node->level = nw->level + 1;
+	node->population = nw->population + ne->population + sw->population + se->population;
+	node->next = hashTable[bucket];
+	hashTable[bucket] = node;
+	if (hashLifeCapped && (hashNodeCount + 1) * sizeof(HashNode) > hashMemoryCap)
+		hashLifeAborted = true;
+
+	//	keep the chains short
+	if (++hashNodeCount > hashTable.size())
+	{
+		vector<HashNode*> oldTable(2 * hashTable.size(), NULL);
+		oldTable.swap(hashTable);
+		for (size_t b=0; b < oldTable.size(); b++)
+		{
+			HashNode* next;
+			for (HashNode* n = oldTable[b]; n != NULL; n = next)
+			{
+				next = n->next;
+				size_t newBucket = hashLifeHash(n->nw, n->ne, n->sw, n->se) & (hashTable.size() - 1);
+				n->next = hashTable[newBucket];
+				hashTable[newBucket] = n;
+			}
+		}
+	}
+	return node;
+}
+
+HashNode* hashLifeEmpty(unsigned int level)
+{
+	if (hashEmptyNodes.empty())
+	{
+		hashLeaf[0] = HashNode();
+		hashLeaf[1] = HashNode();
+		hashLeaf[1].population = 1;
+		hashEmptyNodes.push_back(&hashLeaf[0]);
+	}
+	while (hashEmptyNodes.size() <= level)
+	{
+		HashNode* e = hashEmptyNodes.back();
+		hashEmptyNodes.push_back(hashLifeNode(e, e, e, e));
+	}
+	return hashEmptyNodes[level];
+}
+
+//	The square of half the size at the center of a node
+static inline HashNode* hashLifeCenter(HashNode* n)
+{
+	return hashLifeNode(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+}
+
+//	The center square of a level-2 node (4x4 cells) after one generation
+static HashNode* hashLifeBaseCase(HashNode* n)
+{
+	//	cells[r][c] of the 4x4 square
+	unsigned int cells[4][4];
+	HashNode* quads[4] = {n->nw, n->ne, n->sw, n->se};
+	for (unsigned int q=0; q < 4; q++)
+	{
+		unsigned int r = 2 * (q / 2), c = 2 * (q % 2);
+		cells[r][c] = quads[q]->nw->population;
+		cells[r][c+1] = quads[q]->ne->population;
+		cells[r+1][c] = quads[q]->sw->population;
+		cells[r+1][c+1] = quads[q]->se->population;
+	}
+
+	HashNode* next[4];
+	for (unsigned int q=0; q < 4; q++)
+	{
+		unsigned int r = 1 + q / 2, c = 1 + q % 2;
+		unsigned int count = cells[r-1][c-1] + cells[r-1][c] + cells[r-1][c+1] +
+							 cells[r][c-1] + cells[r][c+1] +
+							 cells[r+1][c-1] + cells[r+1][c] + cells[r+1][c+1];
+		next[q] = &hashLeaf[((cells[r][c] ? hashSurviveMask : hashBirthMask) >> count) & 1];
+	}
+	return hashLifeNode(next[0], next[1], next[2], next[3]);
+}
+
+//	Returns the center square (level-1) of a node of level >= 2, advanced by
+//	2^stepLog generations, with stepLog <= level-2.  The results are memoized
+//	in the nodes, which is what makes HashLife fast on regular patterns.
+//	Returns NULL (and memoizes nothing) once the step is aborted because the
+//	nodes went over the memory cap.
+HashNode* hashLifeAdvance(HashNode* n, unsigned int stepLog)
+{
+	bool fullStep = (stepLog == n->level - 2);
+	if (n->population == 0)
+		return hashLifeEmpty(n->level - 1);
+	if (fullStep && n->result != NULL)
+		return n->result;
+	if (!fullStep && n->stepResult != NULL && n->stepLog == stepLog)
+		return n->stepResult;
+	if (n->level == 2)
+		return n->result = hashLifeBaseCase(n);
+
+	//	nine overlapping squares of level-1, three by three
+	HashNode* sub[3][3];
+	sub[0][0] = n->nw;
+	sub[0][1] = hashLifeNode(n->nw->ne, n->ne->nw, n->nw->se, n->ne->sw);
+	sub[0][2] = n->ne;
+	sub[1][0] = hashLifeNode(n->nw->sw, n->nw->se, n->sw->nw, n->sw->ne);
+	sub[1][1] = hashLifeCenter(n);
+	sub[1][2] = hashLifeNode(n->ne->sw, n->ne->se, n->se->nw, n->se->ne);
+	sub[2][0] = n->sw;
+	sub[2][1] = hashLifeNode(n->sw->ne, n->se->nw, n->sw->se, n->se->sw);
+	sub[2][2] = n->se;
+
+	//	for a full step the nine squares are advanced by half the generations
+	//	here, and by the other half below.  For a shorter step they are only
+	//	cropped to their center.
+	HashNode* half[3][3];
+	for (unsigned int r=0; r < 3; r++)
+		for (unsigned int c=0; c < 3; c++)
+		{
+			half[r][c] = fullStep ? hashLifeAdvance(sub[r][c], n->level - 3) : hashLifeCenter(sub[r][c]);
+			if (hashLifeAborted)
+				return NULL;
+		}
+
+	unsigned int quarterLog = fullStep ? n->level - 3 : stepLog;
+	HashNode* quarter[4];
+	for (unsigned int q=0; q < 4; q++)
+	{
+		unsigned int r = q / 2, c = q % 2;
+		quarter[q] = hashLifeAdvance(hashLifeNode(half[r][c], half[r][c+1], half[r+1][c], half[r+1][c+1]), quarterLog);
+		if (hashLifeAborted)
+			return NULL;
+	}
+	HashNode* result = hashLifeNode(quarter[0], quarter[1], quarter[2], quarter[3]);
+
+	if (fullStep)
+		n->result = result;
+	else
+	{
+		n->stepResult = result;
+		n->stepLog = stepLog;
+	}
+	return result;
+}
+
+//	Advances the whole quadtree by 2^stepLog generations.  If the nodes go
+//	over the memory cap during the step, the step is abandoned, the nodes it
+//	created are collected, and it is taken as two steps of half the size,
+//	down to single generations (which always complete, so that a tree that
+//	is over the cap by itself still advances).  Returns the number of
+//	generations advanced, less than 2^stepLog if the root would have to grow
+//	beyond MAX_HASHLIFE_LEVEL.
+uint64_t hashLifeStep(unsigned int stepLog)
+{
+	//	the memoized results are only valid for the rule they were computed with
+	if (hashBirthMask != activeRule.birthMask || hashSurviveMask != activeRule.surviveMask ||
+		hashNodeCount * sizeof(HashNode) > hashMemoryCap)
+	{
+		hashLifeCollect();
+		hashBirthMask = activeRule.birthMask;
+		hashSurviveMask = activeRule.surviveMask;
+	}
+
+	//	A pattern grows by at most one cell per generation.  It must sit in the
+	//	center of the center of the root, and that margin must be at least
+	//	2^stepLog cells, so that nothing is lost when only the center square
+	//	of the root is kept.
+	while (hashRoot->level < stepLog + 3 ||
+		   hashLifeCenter(hashLifeCenter(hashRoot))->population != hashRoot->population)
+	{
+		if (hashRoot->level >= MAX_HASHLIFE_LEVEL)
+			return 0;
+		HashNode* e = hashLifeEmpty(hashRoot->level - 1);
+		int64_t shift = ((int64_t) 1) << (hashRoot->level - 1);
+		hashRoot = hashLifeNode(hashLifeNode(e, e, e, hashRoot->nw),
+								hashLifeNode(e, e, hashRoot->ne, e),
+								hashLifeNode(e, hashRoot->sw, e, e),
+								hashLifeNode(hashRoot->se, e, e, e));
+		hashRootRow -= shift;
+		hashRootCol -= shift;
+	}
+
+	int64_t shift = ((int64_t) 1) << (hashRoot->level - 2);
+	hashLifeCapped = (stepLog > 0);
+	HashNode* next = hashLifeAdvance(hashRoot, stepLog);
+	hashLifeCapped = false;
+	if (hashLifeAborted)
+	{
+		hashLifeAborted = false;
+		hashLifeCollect();
+		uint64_t done = hashLifeStep(stepLog - 1);
+		if (done == ((uint64_t) 1) << (stepLog - 1))
+			done += hashLifeStep(stepLog - 1);
+		return done;
+	}
+	hashRoot = next;
+	hashRootRow += shift;
+	hashRootCol += shift;
+	return ((uint64_t) 1) << stepLog;
+}
+
+//	Garbage collection: frees the nodes that cannot be reached from the root
+//	and clears the memoized results (which may point at freed nodes)
+static void hashLifeMark(HashNode* n)
+{
+	if (n->level == 0 || n->marked)
+		return;
+	n->marked = true;
+	hashLifeMark(n->nw);
+	hashLifeMark(n->ne);
+	hashLifeMark(n->sw);
+	hashLifeMark(n->se);
+}
+
+void hashLifeCollect(void)
+{
+	if (hashRoot != NULL)
+		hashLifeMark(hashRoot);
+	for (size_t k=1; k < hashEmptyNodes.size(); k++)
+		hashLifeMark(hashEmptyNodes[k]);
+
+	for (size_t b=0; b < hashTable.size(); b++)
+	{
+		HashNode** link = &hashTable[b];
+		while (*link != NULL)
+		{
+			HashNode* node = *link;
+			if (node->marked)
+			{
+				node->marked = false;
+				node->result = NULL;
+				node->stepResult = NULL;
+				link = &node->next;
+			}
+			else
+			{
+				*link = node->next;
+				delete node;
+				hashNodeCount--;
+			}
+		}
+	}
+}
+
+//	Builds the node of the given level whose top-left cell is (row, col)
+static HashNode* hashLifeBuild(unsigned int level, unsigned int row, unsigned int col)
+{
+	if (row >= NUM_ROWS || col >= NUM_COLS)
+		return hashLifeEmpty(level);
+	if (level == 0)
+	{
+		bool alive = bitPackedMode ? (currentBits[(row + 1) * bitWordsPerRow + 1 + col/64] >> (col % 64)) & 1
+								   : currentGrid2D[row][col] != 0;
+		return &hashLeaf[alive];
+	}
+	unsigned int half = 1 << (level - 1);
+	return hashLifeNode(hashLifeBuild(level - 1, row, col),
+						hashLifeBuild(level - 1, row, col + half),
+						hashLifeBuild(level - 1, row + half, col),
+						hashLifeBuild(level - 1, row + half, col + half));
+}
+
+//	Replaces the quadtree with the current grid
+void hashLifeFromGrid(void)
+{
+	unsigned int level = 3;
+	while ((1U << level) < max(NUM_ROWS, NUM_COLS))
+		level++;
+	hashLifeEmpty(level);
+	hashRoot = hashLifeBuild(level, 0, 0);
+	hashRootRow = 0;
+	hashRootCol = 0;
+}
+
+//	Writes the live cells of a node whose top-left cell is at (row, col)
+static void hashLifeWrite(HashNode* n, int64_t row, int64_t col)
+{
+	int64_t size = ((int64_t) 1) << n->level;
+	if (n->population == 0 || row >= NUM_ROWS || col >= NUM_COLS || row + size <= 0 || col + size <= 0)
+		return;
+	if (n->level == 0)
+	{
+		if (bitPackedMode)
+			currentBits[(row + 1) * bitWordsPerRow + 1 + col/64] |= ((uint64_t) 1) << (col % 64);
+		else
+			currentGrid2D[row][col] = 1;
+		return;
+	}
+	int64_t half = size / 2;
+	hashLifeWrite(n->nw, row, col);
+	hashLifeWrite(n->ne, row, col + half);
+	hashLifeWrite(n->sw, row + half, col);
+	hashLifeWrite(n->se, row + half, col + half);
+}
+
+//	Replaces the current grid with the part of the quadtree that it covers
+void hashLifeToGrid(void)
+{
+	if (bitPackedMode)
+	{
+		for (unsigned int i=0; i < NUM_ROWS; i++)
+			memset(currentBits + (i + 1) * bitWordsPerRow, 0, bitWordsPerRow * sizeof(uint64_t));
+	}
+	else
+		memset(currentGrid, 0, (NUM_ROWS + 2) * (NUM_COLS + 2) * sizeof(CellType));
+	hashLifeWrite(hashRoot, hashRootRow, hashRootCol);
+	fillHalo();
+	resetAges();
+}
+
+//	GUI 'h' key, run between two generations: jump 2^hashLifeStepLog
+//	generations ahead
+void hashLifeJump(void)
+{
+	if ((activeRule.birthMask & 1) || activeRule.extended)
+	{
+		cout << "HashLife cannot run a B0 rule, or a rule that is not Life-like" << endl;
+		return;
+	}
+	applyPendingRule();
+	hashLifeFromGrid();
+	uint64_t done = hashLifeStep(hashLifeStepLog);
+	if (done < ((uint64_t) 1) << hashLifeStepLog)
+		cout << "The pattern is too large for HashLife, stopped after " << done << " generations" << endl;
+	hashLifeToGrid();
+	generation += done;
+	allTilesDirty = true;
+	population = countPopulation();
+	lastBirths = 0;
+	lastDeaths = 0;
+}
+
+//	Headless HashLife run: jumps of 2^hashLifeStepLog generations until
+//	--generations is reached (a single jump if it was not given)
+void runHashLife(void)
+{
+	if ((activeRule.birthMask & 1) || activeRule.extended)
+	{
+		cout << "HashLife cannot run a B0 rule, or a rule that is not Life-like" << endl;
+		exit(5);
+	}
+	double startTime = currentTime();
+	hashLifeFromGrid();
+	cout << NUM_ROWS << " x " << NUM_COLS << " grid, rule " << activeRule.name
+		 << ", HashLife steps of 2^" << hashLifeStepLog << " generations" << endl;
+	cout << "conversion from the grid: " << currentTime() - startTime << " s" << endl;
+	cout << "generation\tpopulation\tnodes\tseconds" << endl;
+
+	uint64_t hashGeneration = 0;
+	do
+	{
+		startTime = currentTime();
+		uint64_t done = hashLifeStep(hashLifeStepLog);
+		hashGeneration += done;
+		generation += done;
+		cout << hashGeneration << "\t" << hashRoot->population << "\t"
+			 << hashNodeCount << "\t" << currentTime() - startTime << endl;
+		if (done < ((uint64_t) 1) << hashLifeStepLog)
+		{
+			cout << "The pattern is too large for HashLife, stopped" << endl;
+			break;
+		}
+	}
+	while (hashGeneration < lastGeneration);
+
+	startTime = currentTime();
+	hashLifeToGrid();
+	cout << "conversion to the grid: " << currentTime() - startTime << " s" << endl;
+}
+
+void cleanupAndquit(void)
+{
+	//	ask the threads to stop at the end of the generation, then join them
+	stopRequested = true;
+	joinThreads();
+	stopCheckpointWriter(true);
+	//	free the grids
+	unmapCheckpoint();
+	deleteGrid2D(currentGrid2D);
+	deleteGrid2D(nextGrid2D);
+	deleteGrid2D(currentAge2D);
+	deleteGrid2D(nextAge2D);
+	for (unsigned int k=0; k < 3; k++)
+		deleteGrid2D(renderFrame[k]);
+	exit(0);
+}
+
+
+
+#if 0
+//==================================================================================
+#pragma mark -
+#pragma mark Checkpoints
+//==================================================================================
+#endif
+
+//	Starts the thread that writes the checkpoints, if there is a checkpoint file
+void startCheckpointWriter(void)
+{
+	if (checkpointFile == NULL)
+		return;
+	checkpointBits = new uint64_t[(NUM_ROWS + 2) * bitWordsPerRow]();
+	nextCheckpoint = generation + checkpointEvery;
+	int err = pthread_create(&checkpointThread, NULL, checkpointThreadFunc, NULL);
+	if (err != 0)
+	{
+		cout << "Could not create the checkpoint thread. Error code: " << err << endl;
+		exit(6);
+	}
+}
+
+//	Waits for the checkpoint being written, writes a last one if asked to,
+//	and ends the writer thread
+void stopCheckpointWriter(bool writeLast)
+{
+	if (checkpointFile == NULL)
+		return;
+	if (writeLast)
+		requestCheckpoint(true);
+	pthread_mutex_lock(&checkpointLock);
+	checkpointExit = true;
+	pthread_cond_signal(&checkpointCond);
+	pthread_mutex_unlock(&checkpointLock);
+	pthread_join(checkpointThread, NULL);
+	delete []checkpointBits;
+	checkpointBits = NULL;
+}
+
+//	Called between two generations (or once the threads are gone): copies the
+//	current state for the writer thread.  Unless wait is true, the checkpoint
+//	is skipped if the previous one is still being written, rather than holding
+//	up the workers.  Returns true if the checkpoint was handed to the writer.
+bool requestCheckpoint(bool wait)
+{
+	if (checkpointBits == NULL)
+		return false;
+	if (activeRule.numStates > 2)
+	{
+		cout << "generation " << generation << ": a checkpoint only holds live and dead cells, not the states of "
+			 << activeRule.name << ", skipped" << endl;
+		return false;
+	}
+	pthread_mutex_lock(&checkpointLock);
+	if (checkpointPending && !wait)
+	{
+		pthread_mutex_unlock(&checkpointLock);
+		cout << "generation " << generation << ": previous checkpoint still being written, skipped" << endl;
+		return false;
+	}
+	while (checkpointPending)
+		pthread_cond_wait(&checkpointCond, &checkpointLock);
+
+	CheckpointHeader* header = &checkpointHeader;
+	memset(header, 0, sizeof(CheckpointHeader));
+	memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+	header->numRows = NUM_ROWS;
+	header->numCols = NUM_COLS;
+	header->wordsPerRow = bitWordsPerRow;
+	header->frameBehavior = frameBehavior;
+	header->generation = generation;
+	snprintf(header->rule, sizeof(header->rule), "%s", activeRule.name);
+	header->randomSeed = randomSeed;
+	header->numResets = numResets;
+
+	//	the bit grid already has the layout of the file
+	if (bitPackedMode)
+		memcpy(checkpointBits, currentBits, (NUM_ROWS + 2) * bitWordsPerRow * sizeof(uint64_t));
+	else
+		packGrid(currentGrid2D, checkpointBits);
+
+	checkpointPending = true;
+	pthread_cond_broadcast(&checkpointCond);
+	pthread_mutex_unlock(&checkpointLock);
+	return true;
+}
+
+//	The writer thread: saves each checkpoint to a temporary file, which then
+//	replaces the checkpoint file, so that there is always a complete one
+void* checkpointThreadFunc(void*)
+{
+	string tempFile = string(checkpointFile) + ".tmp";
+	pthread_mutex_lock(&checkpointLock);
+	while (true)
+	{
+		while (!checkpointPending && !checkpointExit)
+			pthread_cond_wait(&checkpointCond, &checkpointLock);
+		if (!checkpointPending)
+			break;
+		pthread_mutex_unlock(&checkpointLock);
+
+		double startTime = currentTime();
+		size_t gridSize = (size_t) (checkpointHeader.numRows + 2) * checkpointHeader.wordsPerRow * sizeof(uint64_t);
+		vector<char> page(CHECKPOINT_HEADER_SIZE, 0);
+		memcpy(page.data(), &checkpointHeader, sizeof(CheckpointHeader));
+		FILE* file = fopen(tempFile.c_str(), "wb");
+		bool ok = (file != NULL) &&
+				  fwrite(page.data(), 1, page.size(), file) == page.size() &&
+				  fwrite(checkpointBits, 1, gridSize, file) == gridSize;
+		if (file != NULL)
+			ok = (fclose(file) == 0) && ok;
+		if (ok)
+			ok = rename(tempFile.c_str(), checkpointFile) == 0;
+		if (ok)
+			cout << "generation " << checkpointHeader.generation << " saved to " << checkpointFile
+				 << " in " << currentTime() - startTime << " s" << endl;
+		else
+			cout << "Could not write the checkpoint file " << checkpointFile << endl;
+
+		pthread_mutex_lock(&checkpointLock);
+		checkpointPending = false;
+		pthread_cond_broadcast(&checkpointCond);
+	}
+	pthread_mutex_unlock(&checkpointLock);
+	return NULL;
+}
+
+//	Reads and checks the header of a checkpoint file.  main reads it before
+//	the grid is allocated, to check the rule and frame behavior of the
+//	checkpoint against the options.
+void readCheckpointHeader(const char* fileName, CheckpointHeader* header, size_t* fileSize)
+{
+	int fd = open(fileName, O_RDONLY);
+	struct stat fileStat;
+	if (fd < 0 || fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < CHECKPOINT_HEADER_SIZE ||
+		pread(fd, header, sizeof(CheckpointHeader), 0) != (ssize_t) sizeof(CheckpointHeader))
+	{
+		cout << "Could not read the checkpoint file " << fileName << endl;
+		exit(6);
+	}
+	close(fd);
+	header->rule[sizeof(header->rule) - 1] = 0;
+	size_t gridSize = (size_t) (header->numRows + 2) * header->wordsPerRow * sizeof(uint64_t);
+	if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+		header->wordsPerRow != (header->numCols + 63) / 64 + 2 || header->frameBehavior > FRAME_WRAP ||
+		(size_t) fileStat.st_size < CHECKPOINT_HEADER_SIZE + gridSize)
+	{
+		cout << fileName << " is not a valid checkpoint file" << endl;
+		exit(6);
+	}
+	*fileSize = fileStat.st_size;
+}
+
+//	Replaces the current grid, generation, rule, frame behavior and random
+//	seed with those of a checkpoint file.  The file is mapped in memory: in
+//	bit-packed mode the mapping (private, so copy-on-write) becomes the current
+//	bit grid, and is only read in as the first generation is computed.
+void restoreCheckpoint(const char* fileName)
+{
+	//	the grids were just allocated, so none of them is in an earlier mapping
+	unmapCheckpoint();
+	CheckpointHeader header;
+	size_t fileSize;
+	readCheckpointHeader(fileName, &header, &fileSize);
+	int fd = open(fileName, O_RDONLY);
+	char* base = (fd < 0) ? (char*) MAP_FAILED
+						  : (char*) mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (fd >= 0)
+		close(fd);
+	if (base == MAP_FAILED)
+	{
+		cout << "Could not map the checkpoint file " << fileName << endl;
+		exit(6);
+	}
+	if (header.numRows != NUM_ROWS || header.numCols != NUM_COLS)
+	{
+		cout << "The checkpoint is a " << header.numRows << " x " << header.numCols
+			 << " grid, not " << NUM_ROWS << " x " << NUM_COLS << endl;
+		exit(6);
+	}
+	if (!compileRule(header.rule, &activeRule))
+	{
+		cout << "Invalid rule " << header.rule << " in the checkpoint" << endl;
+		exit(5);
+	}
+	frameBehavior = header.frameBehavior;
+	generation = header.generation;
+	randomSeed = header.randomSeed;
+	numResets = header.numResets;
+
+	uint64_t* bits = (uint64_t*) (base + CHECKPOINT_HEADER_SIZE);
+	madvise(base, fileSize, MADV_SEQUENTIAL);
+	if (bitPackedMode)
+	{
+		delete []currentBits;
+		currentBits = bits;
+		restoreMapping = base;
+		restoreMappingSize = fileSize;
+	}
+	else
+	{
+		unpackGrid(bits, currentGrid2D);
+		munmap(base, fileSize);
+	}
+	fillHalo();
+	resetAges();
+	allTilesDirty = true;
+	population = countPopulation();
+	cout << "restored generation " << generation << " of rule " << activeRule.name << " from " << fileName << endl;
+}
+
+//	Unmaps the checkpoint file that restoreCheckpoint made a bit grid.  One
+//	of currentBits and nextBits still points into it, so this is only done
+//	when the grids are no longer used.
+void unmapCheckpoint(void)
+{
+	if (restoreMapping != NULL)
+	{
+		munmap(restoreMapping, restoreMappingSize);
+		restoreMapping = NULL;
+		restoreMappingSize = 0;
+	}
+}
+
+
+#if 0
+//==================================================================================
+#pragma mark -
+#pragma mark Multi-process mode
+//==================================================================================
+#endif
+
+//	Splits the grid into tiles, runs one process per tile for lastGeneration
+//	generations, and reports the time each one spent computing and
+//	communicating
+void runProcesses(void)
+{
+	unsigned int numTiles = processRows * processCols;
+	uint64_t numGenerations = (lastGeneration != 0) ? lastGeneration : 100;
+	unsigned int gridWords = (NUM_COLS + 63) / 64;
+	unsigned int maxRows = 0, maxWords = 0;
+
+	//	the shared segment: the tiles, two sets of four edges per tile, and
+	//	the whole grid for --verify
+	bitWordsPerRow = gridWords + 2;
+	size_t tilesSize = numTiles * sizeof(TileInfo);
+	for (unsigned int r = 0; r < processRows; r++)
+		maxRows = max(maxRows, (r + 1) * NUM_ROWS / processRows - r * NUM_ROWS / processRows);
+	for (unsigned int c = 0; c < processCols; c++)
+		maxWords = max(maxWords, (c + 1) * gridWords / processCols - c * gridWords / processCols);
+	tileEdgeWords = max((size_t) maxWords, (size_t) (maxRows + 63) / 64);
+	size_t edgesSize = (size_t) numTiles * 2 * 4 * tileEdgeWords * sizeof(uint64_t);
+	size_t gatheredSize = verifyMode ? (size_t) (NUM_ROWS + 2) * bitWordsPerRow * sizeof(uint64_t) : 0;
+	char* segment = (char*) mmap(NULL, tilesSize + edgesSize + gatheredSize, PROT_READ | PROT_WRITE,
+								 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (segment == MAP_FAILED)
+	{
+		cout << "Could not allocate the shared memory of the processes" << endl;
+		exit(9);
+	}
+	tiles = (TileInfo*) segment;
+	tileEdges = (uint64_t*) (segment + tilesSize);
+	gatheredBits = verifyMode ? (uint64_t*) (segment + tilesSize + edgesSize) : NULL;
+	for (unsigned int t = 0; t < numTiles; t++)
+	{
+		unsigned int r = t / processCols, c = t % processCols;
+		TileInfo* info = new (tiles + t) TileInfo;
+		info->startRow = r * NUM_ROWS / processRows;
+		info->endRow = (r + 1) * NUM_ROWS / processRows;
+		info->startCol = 64 * (c * gridWords / processCols);
+		info->endCol = min(64 * ((c + 1) * gridWords / processCols), NUM_COLS);
+		info->published = 0;
+	}
+
+	cout << NUM_ROWS << " x " << NUM_COLS << " grid, rule " << activeRule.name << ", "
+		 << frameNames[frameBehavior] << " frame, " << numGenerations << " generations, "
+		 << processRows << " x " << processCols << " processes" << endl;
+	lastGeneration = numGenerations;
+	double startTime = currentTime();
+	vector<pid_t> pids(numTiles);
+	for (unsigned int t = 0; t < numTiles; t++)
+	{
+		pids[t] = fork();
+		if (pids[t] < 0)
+		{
+			cout << "Unable to create process " << t << ": " << strerror(errno) << endl;
+			for (unsigned int k = 0; k < t; k++)
+				kill(pids[k], SIGTERM);
+			exit(9);
+		}
+		if (pids[t] == 0)
+		{
+			runTileProcess(t);
+			_exit(0);
+		}
+	}
+
+	//	a process that fails would leave its neighbors waiting forever
+	bool failed = false;
+	for (unsigned int done = 0; done < numTiles; done++)
+	{
+		int status;
+		pid_t pid = wait(&status);
+		if (!failed && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+		{
+			cout << "Process " << pid << " failed" << endl;
+			for (unsigned int k = 0; k < numTiles; k++)
+				kill(pids[k], SIGTERM);
+			failed = true;
+		}
+	}
+	if (failed)
+		exit(9);
+	double elapsed = currentTime() - startTime;
+
+	uint64_t totalPopulation = 0;
+	cout << "process	rows	columns	compute s	exchange s	wait s" << endl;
+	for (unsigned int t = 0; t < numTiles; t++)
+	{
+		const TileInfo& info = tiles[t];
+		cout << t << "	" << info.startRow << "-" << info.endRow - 1 << "	" << info.startCol << "-" << info.endCol - 1
+			 << "	" << info.computeTime << "	" << info.exchangeTime << "	" << info.waitTime << endl;
+		totalPopulation += info.population;
+	}
+	cout << elapsed << " s, " << (double) NUM_ROWS * NUM_COLS * numGenerations / elapsed
+		 << " cell updates/s, population " << totalPopulation << endl;
+
+	//	the same run in this process, with the whole grid
+	if (verifyMode)
+	{
+		bitPackedMode = true;
+		initializeApplication(NUM_ROWS, NUM_COLS);
+		for (uint64_t g = 0; g < numGenerations; g++)
+			oneGeneration();
+		uint64_t lastWordMask = (NUM_COLS % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+		bool same = true;
+		for (unsigned int i = 0; i < NUM_ROWS; i++)
+		{
+			const uint64_t* row = currentBits + (i + 1) * bitWordsPerRow;
+			const uint64_t* gathered = gatheredBits + (i + 1) * bitWordsPerRow;
+			for (unsigned int w = 1; w <= gridWords; w++)
+				same &= ((row[w] ^ gathered[w]) & ((w == gridWords) ? lastWordMask : ~((uint64_t) 0))) == 0;
+		}
+		cout << "\tresult " << (same ? "identical to" : "DIFFERENT from") << " a single process" << endl;
+	}
+	munmap(segment, tilesSize + edgesSize + gatheredSize);
+}
+
+//	The work of the process of a tile
+void runTileProcess(unsigned int tile)
+{
+	TileInfo* info = tiles + tile;
+	unsigned int numRows = info->endRow - info->startRow,
+				 numCols = info->endCol - info->startCol,
+				 wordsPerRow = (numCols + 63) / 64 + 2,
+				 numWords = wordsPerRow - 2;
+	uint64_t lastWordMask = (numCols % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (numCols % 64)) - 1;
+	unsigned int birthMask = activeRule.birthMask,
+				 surviveMask = activeRule.surviveMask;
+	vector<uint64_t> bits((numRows + 2) * wordsPerRow, 0);
+	vector<uint64_t> nextBits((numRows + 2) * wordsPerRow, 0);
+	fillTile(info, bits.data(), wordsPerRow);
+
+	double computeTime = 0.0, exchangeTime = 0.0, waitTime = 0.0;
+	int neighbors[8];
+	unsigned int numNeighbors = 0;
+	for (int dr = -1; dr <= 1; dr++)
+		for (int dc = -1; dc <= 1; dc++)
+		{
+			int neighbor = (dr != 0 || dc != 0) ? neighborTile(tile, dr, dc) : -1;
+			if (neighbor >= 0)
+				neighbors[numNeighbors++] = neighbor;
+		}
+
+	for (uint64_t g = 0; g < lastGeneration; g++)
+	{
+		unsigned int parity = g & 1;
+		double time0 = currentTime();
+		publishTileEdges(tile, parity, bits.data(), wordsPerRow);
+		info->published.store(g + 1, memory_order_release);
+		double time1 = currentTime();
+
+		//	the inside of the tile does not need the halo, except for the
+		//	first and last words of each row, recomputed below
+		for (unsigned int i = 1; i + 1 < numRows; i++)
+		{
+			const uint64_t* row = bits.data() + (i + 1) * wordsPerRow;
+			bitRowNewState(row - wordsPerRow, row, row + wordsPerRow, nextBits.data() + (i + 1) * wordsPerRow,
+						   numWords, birthMask, surviveMask);
+		}
+		double time2 = currentTime();
+
+		for (unsigned int k = 0; k < numNeighbors; k++)
+		{
+			while (tiles[neighbors[k]].published.load(memory_order_acquire) < g + 1)
+				sched_yield();
+		}
+		double time3 = currentTime();
+		readTileHalo(tile, parity, bits.data(), wordsPerRow);
+		double time4 = currentTime();
+
+		//	the cells along the edges of the tile
+		for (unsigned int i = 0; i < numRows; i++)
+		{
+			const uint64_t* row = bits.data() + (i + 1) * wordsPerRow;
+			uint64_t* out = nextBits.data() + (i + 1) * wordsPerRow;
+			if (i == 0 || i == numRows-1)
+				bitRowNewState(row - wordsPerRow, row, row + wordsPerRow, out, numWords, birthMask, surviveMask);
+			else
+			{
+				bitRowNewState(row - wordsPerRow, row, row + wordsPerRow, out, 1, birthMask, surviveMask);
+				if (numWords > 1)
+					bitRowNewState(row - wordsPerRow + numWords-1, row + numWords-1, row + wordsPerRow + numWords-1,
+								   out + numWords-1, 1, birthMask, surviveMask);
+			}
+			out[numWords] &= lastWordMask;
+
+			if (frameBehavior == FRAME_DEAD)
+			{
+				if ((i == 0 && info->startRow == 0) || (i == numRows-1 && info->endRow == NUM_ROWS))
+					memset(out + 1, 0, numWords * sizeof(uint64_t));
+				if (info->startCol == 0)
+					out[1] &= ~((uint64_t) 1);
+				if (info->endCol == NUM_COLS)
+					out[1 + (numCols-1) / 64] &= ~(((uint64_t) 1) << ((numCols-1) % 64));
+			}
+		}
+		bits.swap(nextBits);
+		double time5 = currentTime();
+
+		computeTime += (time2 - time1) + (time5 - time4);
+		exchangeTime += (time1 - time0) + (time4 - time3);
+		waitTime += time3 - time2;
+	}
+
+	info->population = 0;
+	for (unsigned int i = 0; i < numRows; i++)
+	{
+		const uint64_t* row = bits.data() + (i + 1) * wordsPerRow;
+		for (unsigned int w = 1; w <= numWords; w++)
+			info->population += __builtin_popcountll(row[w]);
+		if (gatheredBits != NULL)
+			memcpy(gatheredBits + (info->startRow + i + 1) * bitWordsPerRow + 1 + info->startCol / 64,
+				   row + 1, numWords * sizeof(uint64_t));
+	}
+	info->computeTime = computeTime;
+	info->exchangeTime = exchangeTime;
+	info->waitTime = waitTime;
+}
+
+//	One of the edges of a tile, for the generations of a given parity: a row
+//	of words (top and bottom), or a column of bits, one per row of the tile
+uint64_t* tileEdge(unsigned int tile, unsigned int parity, unsigned int side)
+{
+	return tileEdges + ((tile * 2 + parity) * 4 + side) * tileEdgeWords;
+}
+
+//	The tile next to a tile in the given direction, or -1 if there is none
+//	(at the edge of the grid, unless it wraps around)
+int neighborTile(unsigned int tile, int rowStep, int colStep)
+{
+	int r = tile / processCols + rowStep,
+		c = tile % processCols + colStep;
+	if (frameBehavior == FRAME_WRAP)
+	{
+		r = (r + processRows) % processRows;
+		c = (c + processCols) % processCols;
+	}
+	else if (r < 0 || r >= (int) processRows || c < 0 || c >= (int) processCols)
+		return -1;
+	return r * processCols + c;
+}
+
+//	The initial cells of a tile: the same as those of the whole grid in a
+//	single process, since the tile is made of whole words of its rows
+void fillTile(const TileInfo* info, uint64_t* bits, unsigned int wordsPerRow)
+{
+	uint64_t key = randomHash(randomSeed, RANDOM_STREAM_RESET);
+	unsigned int gridWords = (NUM_COLS + 63) / 64,
+				 firstWord = info->startCol / 64,
+				 numWords = wordsPerRow - 2;
+	uint64_t lastWordMask = (NUM_COLS % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+	unsigned int rowOffset = (NUM_ROWS - patternRows) / 2,
+				 colOffset = (NUM_COLS - patternCols) / 2;
+
+	for (unsigned int i = info->startRow; i < info->endRow; i++)
+	{
+		uint64_t* row = bits + (i - info->startRow + 1) * wordsPerRow;
+		if (patternRuns.empty())
+		{
+			for (unsigned int w = 1; w <= numWords; w++)
+				row[w] = randomDensityWord(key, i * gridWords + firstWord + w, densityLevel);
+			if (info->endCol == NUM_COLS)
+				row[numWords] &= lastWordMask;
+		}
+		for (const PatternRun& run : patternRuns)
+		{
+			if (run.row + rowOffset != i)
+				continue;
+			for (unsigned int j = colOffset + run.col; j < colOffset + run.col + run.length; j++)
+			{
+				if (j >= info->startCol && j < info->endCol)
+					row[1 + (j - info->startCol) / 64] |= ((uint64_t) 1) << (j % 64);
+			}
+		}
+	}
+}
+
+//	Copies the cells along the edges of a tile to its shared edges
+void publishTileEdges(unsigned int tile, unsigned int parity, const uint64_t* bits, unsigned int wordsPerRow)
+{
+	const TileInfo* info = tiles + tile;
+	unsigned int numRows = info->endRow - info->startRow,
+				 numCols = info->endCol - info->startCol,
+				 numWords = wordsPerRow - 2;
+	uint64_t* left = tileEdge(tile, parity, EDGE_LEFT);
+	uint64_t* right = tileEdge(tile, parity, EDGE_RIGHT);
+
+	memcpy(tileEdge(tile, parity, EDGE_TOP), bits + wordsPerRow + 1, numWords * sizeof(uint64_t));
+	memcpy(tileEdge(tile, parity, EDGE_BOTTOM), bits + numRows * wordsPerRow + 1, numWords * sizeof(uint64_t));
+	memset(left, 0, ((numRows + 63) / 64) * sizeof(uint64_t));
+	memset(right, 0, ((numRows + 63) / 64) * sizeof(uint64_t));
+	for (unsigned int i = 0; i < numRows; i++)
+	{
+		const uint64_t* row = bits + (i + 1) * wordsPerRow;
+		left[i / 64] |= (row[1] & 1) << (i % 64);
+		right[i / 64] |= ((row[1 + (numCols-1) / 64] >> ((numCols-1) % 64)) & 1) << (i % 64);
+	}
+}
+
+//	Fills the halo of a tile with the edges of its neighbors (or dead cells
+//	where there is no neighbor)
+void readTileHalo(unsigned int tile, unsigned int parity, uint64_t* bits, unsigned int wordsPerRow)
+{
+	const TileInfo* info = tiles + tile;
+	unsigned int numRows = info->endRow - info->startRow,
+				 numCols = info->endCol - info->startCol,
+				 numWords = wordsPerRow - 2;
+	unsigned int rightWord = 1 + numCols / 64;
+	uint64_t rightBit = ((uint64_t) 1) << (numCols % 64);
+	const uint64_t leftBit = ((uint64_t) 1) << 63;
+
+	//	the halo rows, then their corner cells
+	int above = neighborTile(tile, -1, 0),
+		below = neighborTile(tile, 1, 0);
+	uint64_t* top = bits;
+	uint64_t* bottom = bits + (numRows + 1) * wordsPerRow;
+	memset(top, 0, wordsPerRow * sizeof(uint64_t));
+	memset(bottom, 0, wordsPerRow * sizeof(uint64_t));
+	if (above >= 0)
+		memcpy(top + 1, tileEdge(above, parity, EDGE_BOTTOM), numWords * sizeof(uint64_t));
+	if (below >= 0)
+		memcpy(bottom + 1, tileEdge(below, parity, EDGE_TOP), numWords * sizeof(uint64_t));
+	int corners[4] = {neighborTile(tile, -1, -1), neighborTile(tile, -1, 1),
+					  neighborTile(tile, 1, -1), neighborTile(tile, 1, 1)};
+	for (unsigned int k = 0; k < 4; k++)
+	{
+		if (corners[k] < 0)
+			continue;
+		//	the last cell of the bottom row (or top row, for the corners
+		//	below), or the first cell
+		const TileInfo* corner = tiles + corners[k];
+		const uint64_t* edge = tileEdge(corners[k], parity, (k < 2) ? EDGE_BOTTOM : EDGE_TOP);
+		unsigned int j = (k % 2 == 0) ? corner->endCol - corner->startCol - 1 : 0;
+		bool alive = (edge[j / 64] >> (j % 64)) & 1;
+		uint64_t* haloRow = (k < 2) ? top : bottom;
+		if (alive && k % 2 == 0)
+			haloRow[0] |= leftBit;
+		else if (alive)
+			haloRow[rightWord] |= rightBit;
+	}
+
+	//	the halo cells of each row
+	int leftTile = neighborTile(tile, 0, -1),
+		rightTile = neighborTile(tile, 0, 1);
+	const uint64_t* leftEdge = (leftTile >= 0) ? tileEdge(leftTile, parity, EDGE_RIGHT) : NULL;
+	const uint64_t* rightEdge = (rightTile >= 0) ? tileEdge(rightTile, parity, EDGE_LEFT) : NULL;
+	for (unsigned int i = 0; i < numRows; i++)
+	{
+		uint64_t* row = bits + (i + 1) * wordsPerRow;
+		bool left = leftEdge != NULL && ((leftEdge[i / 64] >> (i % 64)) & 1);
+		bool right = rightEdge != NULL && ((rightEdge[i / 64] >> (i % 64)) & 1);
+		row[0] = left ? leftBit : 0;
+		row[rightWord] = right ? (row[rightWord] | rightBit) : (row[rightWord] & ~rightBit);
 	}
-	return NULL;
 }
 
 
-void oneGeneration(void)
+#if 0
+//==================================================================================
+#pragma mark -
+#pragma mark Batch mode
+//==================================================================================
+#endif
+
+//	Reads the jobs of the batch mode, one per line:
+//		<rule> <density> <seed> <generations> [<rows> <cols>]
+//	The size of the board defaults to that of the command line.
+void loadBatchJobs(const char* fileName)
 {
-	for (unsigned int i=0; i < NUM_ROWS; i++)
+	ifstream file(fileName);
+	if (!file)
 	{
-		for (unsigned int j=0; j < NUM_COLS; j++)
-		{
-			unsigned int newState = cellNewState(i, j, NUM_ROWS, NUM_COLS);
+		cout << "Could not read the batch file " << fileName << endl;
+		exit(8);
+	}
 
-			//	In black and white mode, only alive/dead matters
-			//	Dead is dead in any mode
-			if (colorMode == 0 || newState == 0)
-			{
-				nextGrid2D[i][j] = newState;
-			}
-			//	in color mode, color reflext the "age" of a live cell
-			else
-			{
-				//	Any cell that has not yet reached the "very old cell"
-				//	stage simply got one generation older
-				if (currentGrid2D[i][j] < NB_COLORS-1)
-					nextGrid2D[i][j] = currentGrid2D[i][j] + 1;
-				//	An old cell remains old until it dies
-				else
-					nextGrid2D[i][j] = currentGrid2D[i][j];
+	string line;
+	unsigned int lineNumber = 0;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos || line[start] == '#')
+			continue;
 
-			}
+		BatchJob job;
+		memset(&job, 0, sizeof(BatchJob));
+		stringstream fields(line);
+		string rule;
+		double density = -1.0;
+		unsigned int numRows = NUM_ROWS, numCols = NUM_COLS;
+		RuleTable table;
+		fields >> rule >> density >> job.seed >> job.numGenerations;
+		bool valid = !fields.fail();
+		if (valid && fields >> numRows)
+			valid = !(fields >> numCols).fail();
+		job.numRows = numRows;
+		job.numCols = numCols;
+		if (!valid || !compileRule(rule.c_str(), &table) || table.extended ||
+			density < 0.0 || density > 1.0 || numRows <= 5 || numCols <= 5)
+		{
+			cout << fileName << ", line " << lineNumber << ": invalid job " << line << endl;
+			exit(8);
 		}
+		snprintf(job.rule, sizeof(job.rule), "%s", rule.c_str());
+		job.densityLevel = (unsigned int) (density * 256 + 0.5);
+		batchJobs.push_back(job);
+	}
+	if (batchJobs.empty())
+	{
+		cout << "No job in the batch file " << fileName << endl;
+		exit(8);
 	}
-	generation++;
-	
-	swapGrids();
 }
 
-//	This is the function that determines how a cell update its state
-unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows, unsigned int numCols)
+//	Runs all the jobs of the batch with numThreads threads, then prints the
+//	results of each board and the throughput of the batch
+void runBatch(unsigned int numThreads)
 {
-	//	First count the number of neighbors that are alive
-	//----------------------------------------------------
-	//	Again, this implementation makes no pretense at being the most efficient.
-	//	I am just trying to keep things modular and somewhat readable
-	int count = 0;
+	numThreads = max(1U, min(numThreads, (unsigned int) batchJobs.size()));
+	batchQueues = new BatchQueue[numThreads];
+	for (unsigned int k = 0; k < numThreads; k++)
+	{
+		pthread_mutex_init(&batchQueues[k].lock, NULL);
+		batchQueues[k].numRun = 0;
+		batchQueues[k].numStolen = 0;
+		for (unsigned int job = k * batchJobs.size() / numThreads; job < (k + 1) * batchJobs.size() / numThreads; job++)
+			batchQueues[k].jobs.push_back(job);
+	}
+
+	double startTime = currentTime();
+	vector<ThreadInfo> team(numThreads);
+	for (unsigned int k = 0; k < numThreads; k++)
+	{
+		team[k].threadIndex = k;
+		team[k].endRow = numThreads;
+		int err = pthread_create(&team[k].threadID, NULL, batchThreadFunc, &team[k]);
+		if (err != 0)
+		{
+			cout << "Unable to create thread " << k << ". [" << err << "]: " <<
+				strerror(err) << endl << flush;
+			exit(1);
+		}
+	}
+	for (unsigned int k = 0; k < numThreads; k++)
+		pthread_join(team[k].threadID, NULL);
+	double elapsed = currentTime() - startTime;
 
-	//	Away from the border, we simply count how many among the cell's
-	//	eight neighbors are alive (cell state > 0)
-	if (i>0 && i<numRows-1 && j>0 && j<numCols-1)
+	double cellUpdates = 0.0;
+	cout << "job\trows\tcols\trule\tdensity\tseed\tpopulation\tperiod\tstable at\tcomputed" << endl;
+	for (unsigned int k = 0; k < batchJobs.size(); k++)
 	{
-		//	remember that in C, (x == val) is either 1 or 0
-		count = (currentGrid2D[i-1][j-1] != 0) +
-				(currentGrid2D[i-1][j] != 0) +
-				(currentGrid2D[i-1][j+1] != 0)  +
-				(currentGrid2D[i][j-1] != 0)  +
-				(currentGrid2D[i][j+1] != 0)  +
-				(currentGrid2D[i+1][j-1] != 0)  +
-				(currentGrid2D[i+1][j] != 0)  +
-				(currentGrid2D[i+1][j+1] != 0);
+		const BatchJob& job = batchJobs[k];
+		cout << k << "\t" << job.numRows << "\t" << job.numCols << "\t" << job.rule << "\t"
+			 << job.densityLevel / 256.0 << "\t" << job.seed << "\t" << job.population << "\t";
+		if (job.period != 0)
+			cout << job.period << "\t" << job.stableGeneration;
+		else
+			cout << "-\t-";
+		cout << "\t" << job.generationsComputed << endl;
+		cellUpdates += (double) job.numRows * job.numCols * job.generationsComputed;
 	}
-	//	on the border of the frame...
-	else
+	cout << batchJobs.size() << " boards, " << numThreads << " threads, " << elapsed << " s: "
+		 << batchJobs.size() / elapsed << " boards/s, " << cellUpdates / elapsed << " cell updates/s" << endl;
+	for (unsigned int k = 0; k < numThreads; k++)
 	{
-		#if FRAME_BEHAVIOR == FRAME_DEAD
-		
-			//	Hack to force death of a cell
-			count = -1;
-		
-		#elif FRAME_BEHAVIOR == FRAME_RANDOM
-		
-			count = uniformDistLong(engine);
-		#elif FRAME_BEHAVIOR == FRAME_CLIPPED
-	
-			if (i>0)
-			{
-				if (j>0 && currentGrid2D[i-1][j-1] != 0)
-					count++;
-				if (currentGrid2D[i-1][j] != 0)
-					count++;
-				if (j<numCols-1 && currentGrid2D[i-1][j+1] != 0)
-					count++;
-			}
+		cout << "\tthread " << k << ": " << batchQueues[k].numRun << " boards, "
+			 << batchQueues[k].numStolen << " stolen" << endl;
+		pthread_mutex_destroy(&batchQueues[k].lock);
+	}
+	delete []batchQueues;
+	batchQueues = NULL;
+}
 
-			if (j>0 && currentGrid2D[i][j-1] != 0)
-				count++;
-			if (j<numCols-1 && currentGrid2D[i][j+1] != 0)
-				count++;
+//	A thread of the batch: runs the jobs of its queue, then those it can
+//	steal, on its own board.  (info->endRow is the number of threads.)
+void* batchThreadFunc(void* arg)
+{
+	ThreadInfo* info = (ThreadInfo*) arg;
+	Board board;
+	unsigned int job;
+	while (takeBatchJob(info->threadIndex, info->endRow, &job))
+	{
+		runBoard(&board, &batchJobs[job]);
+		batchQueues[info->threadIndex].numRun++;
+	}
+	return NULL;
+}
 
-			if (i<numRows-1)
-			{
-				if (j>0 && currentGrid2D[i+1][j-1] != 0)
-					count++;
-				if (currentGrid2D[i+1][j] != 0)
-					count++;
-				if (j<numCols-1 && currentGrid2D[i+1][j+1] != 0)
-					count++;
-			}
-			
-	
-		#elif FRAME_BEHAVIOR == FRAME_WRAPPED
-	
-			unsigned int 	iM1 = (i+numRows-1)%numRows,
-							iP1 = (i+1)%numRows,
-							jM1 = (j+numCols-1)%numCols,
-							jP1 = (j+1)%numCols;
-			count = currentGrid2D[iM1][jM1] != 0 +
-					currentGrid2D[iM1][j] != 0 +
-					currentGrid2D[iM1][jP1] != 0  +
-					currentGrid2D[i][jM1] != 0  +
-					currentGrid2D[i][jP1] != 0  +
-					currentGrid2D[iP1][jM1] != 0  +
-					currentGrid2D[iP1][j] != 0  +
-					currentGrid2D[iP1][jP1] != 0 ;
-
-		#else
-			#error undefined frame behavior
-		#endif
-		
-	}	//	end of else case (on border)
-	
-	//	Next apply the cellular automaton rule
-	//----------------------------------------------------
-	//	by default, the grid square is going to be empty/dead
-	unsigned int newState = 0;
-	
-	//	unless....
-	
-	switch (rule)
+//	Takes the next job of a thread's queue, or else steals the last job of
+//	the queue of another thread.  Returns false when all queues are empty.
+bool takeBatchJob(unsigned int threadIndex, unsigned int numThreads, unsigned int* job)
+{
+	BatchQueue* queue = batchQueues + threadIndex;
+	pthread_mutex_lock(&queue->lock);
+	bool found = !queue->jobs.empty();
+	if (found)
 	{
-		//	Rule 1 (Conway's classical Game of Life: B3/S23)
-		case GAME_OF_LIFE_RULE:
+		*job = queue->jobs.front();
+		queue->jobs.pop_front();
+	}
+	pthread_mutex_unlock(&queue->lock);
 
-			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid2D[i][j] != 0)
-			{
-				if (count == 3 || count == 2)
-					newState = 1;
-			}
-			//	if the grid square is currently empty, look at the "Birth of a new cell" rule
-			else
-			{
-				if (count == 3)
-					newState = 1;
-			}
-			break;
-	
-		//	Rule 2 (Coral Growth: B3/S45678)
-		case CORAL_GROWTH_RULE:
+	for (unsigned int k = 1; k < numThreads && !found; k++)
+	{
+		BatchQueue* victim = batchQueues + (threadIndex + k) % numThreads;
+		pthread_mutex_lock(&victim->lock);
+		found = !victim->jobs.empty();
+		if (found)
+		{
+			*job = victim->jobs.back();
+			victim->jobs.pop_back();
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (found)
+			queue->numStolen++;
+	}
+	return found;
+}
 
-			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid2D[i][j] != 0)
-			{
-				if (count > 3)
-					newState = 1;
-			}
-			//	if the grid square is currently empty, look at the "Birth of a new cell" rule
-			else
-			{
-				if (count == 3)
-					newState = 1;
-			}
-			break;
-			
-		//	Rule 3 (Amoeba: B357/S1358)
-		case AMOEBA_RULE:
+//	Runs a job on a board.  The board stops computing when it repeats a
+//	grid of the last cycleHistorySize generations (64 if --cycles was not
+//	given): it skips ahead by a multiple of the period and only computes the
+//	generations that are left.
+void runBoard(Board* board, BatchJob* job)
+{
+	unsigned int historySize = (cycleHistorySize != 0) ? cycleHistorySize : 64;
+	fillBoard(board, job);
+	board->history.assign(1, board->hash);
+	board->historyGenerations.assign(1, 0);
+	unsigned int historyNext = 1 % historySize;
 
-			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid2D[i][j] != 0)
-			{
-				if (count == 1 || count == 3 || count == 5 || count == 8)
-					newState = 1;
-			}
-			//	if the grid square is currently empty, look at the "Birth of a new cell" rule
-			else
-			{
-				if (count == 3 || count == 5 || count == 7)
-					newState = 1;
-			}
-			break;
-		
-		//	Rule 4 (Maze: B3/S12345)							|
-		case MAZE_RULE:
+	job->period = 0;
+	job->generationsComputed = 0;
+	for (unsigned int g = 0; g < job->numGenerations; )
+	{
+		boardGeneration(board);
+		g++;
+		job->generationsComputed++;
+		if (job->period != 0)
+			continue;
 
-			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid2D[i][j] != 0)
-			{
-				if (count >= 1 && count <= 5)
-					newState = 1;
-			}
-			//	if the grid square is currently empty, look at the "Birth of a new cell" rule
-			else
+		for (unsigned int k = 0; k < board->history.size(); k++)
+		{
+			if (board->history[k] == board->hash)
 			{
-				if (count == 3)
-					newState = 1;
+				job->period = g - board->historyGenerations[k];
+				job->stableGeneration = board->historyGenerations[k];
+				g += (job->numGenerations - g) / job->period * job->period;
+				break;
 			}
-			break;
+		}
+		if (board->history.size() < historySize)
+		{
+			board->history.push_back(board->hash);
+			board->historyGenerations.push_back(g);
+		}
+		else
+		{
+			board->history[historyNext] = board->hash;
+			board->historyGenerations[historyNext] = g;
+		}
+		historyNext = (historyNext + 1) % historySize;
+	}
 
-			break;
-		
-		default:
-			cout << "Invalid rule number" << endl;
-			exit(5);
+	uint64_t lastWordMask = (job->numCols % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (job->numCols % 64)) - 1;
+	unsigned int numWords = board->wordsPerRow - 2;
+	job->population = 0;
+	for (unsigned int i=0; i < job->numRows; i++)
+	{
+		const uint64_t* row = board->bits.data() + (i + 1) * board->wordsPerRow;
+		for (unsigned int w=1; w <= numWords; w++)
+			job->population += __builtin_popcountll((w == numWords) ? row[w] & lastWordMask : row[w]);
 	}
+}
+
+//	Sets up a board for a job, with the random grid of its seed and density.
+//	The grid is the same as the initial grid of a single run with this seed.
+void fillBoard(Board* board, const BatchJob* job)
+{
+	RuleTable table;
+	compileRule(job->rule, &table);
+	board->birthMask = table.birthMask;
+	board->surviveMask = table.surviveMask;
+	board->numRows = job->numRows;
+	board->numCols = job->numCols;
+	board->wordsPerRow = (job->numCols + 63) / 64 + 2;
+	board->bits.assign((job->numRows + 2) * board->wordsPerRow, 0);
+	board->nextBits.assign((job->numRows + 2) * board->wordsPerRow, 0);
 
-	return newState;
+	uint64_t key = randomHash(job->seed, RANDOM_STREAM_RESET);
+	unsigned int numWords = board->wordsPerRow - 2;
+	uint64_t lastWordMask = (job->numCols % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (job->numCols % 64)) - 1;
+	board->hash = 0;
+	for (unsigned int i=0; i < job->numRows; i++)
+	{
+		uint64_t* row = board->bits.data() + (i + 1) * board->wordsPerRow;
+		for (unsigned int w=1; w <= numWords; w++)
+			row[w] = randomDensityWord(key, i * numWords + w, job->densityLevel);
+		row[numWords] &= lastWordMask;
+		for (unsigned int w=1; w <= numWords; w++)
+			board->hash ^= gridWordHash((i + 1) * board->wordsPerRow + w, row[w]);
+	}
 }
 
-void cleanupAndquit(void)
+//	The halo of a board, as fillHalo does for the bit grid (no random frame)
+void fillBoardHalo(Board* board)
 {
-	//	join the threads
-	for(unsigned int i = 0; i < NUM_THREADS; i++)
+	unsigned int numRows = board->numRows,
+				 numCols = board->numCols,
+				 wordsPerRow = board->wordsPerRow;
+	unsigned int rightWord = 1 + numCols / 64;
+	uint64_t rightBit = ((uint64_t) 1) << (numCols % 64);
+	bool wrap = (frameBehavior == FRAME_WRAP);
+
+	for (unsigned int i=0; i < numRows; i++)
 	{
-		if(!threadInfo[i].complete)
-			pthread_join(threadInfo[i].threadID, NULL);
-		
+		uint64_t* row = board->bits.data() + (i + 1) * wordsPerRow;
+		bool left = wrap && ((row[1 + (numCols-1) / 64] >> ((numCols-1) % 64)) & 1);
+		bool right = wrap && (row[1] & 1);
+		row[0] = left ? ((uint64_t) 1) << 63 : 0;
+		row[rightWord] = right ? (row[rightWord] | rightBit) : (row[rightWord] & ~rightBit);
+	}
+	uint64_t* top = board->bits.data();
+	uint64_t* bottom = top + (numRows + 1) * wordsPerRow;
+	if (wrap)
+	{
+		memcpy(top, bottom - wordsPerRow, wordsPerRow * sizeof(uint64_t));
+		memcpy(bottom, top + wordsPerRow, wordsPerRow * sizeof(uint64_t));
+	}
+	else
+	{
+		memset(top, 0, wordsPerRow * sizeof(uint64_t));
+		memset(bottom, 0, wordsPerRow * sizeof(uint64_t));
 	}
-	//	free the grids
-	free(currentGrid2D);
-	free(currentGrid);
-	exit(0);
 }
 
+//	Advances a board by one generation with the bit-packed kernel, and
+//	updates its hash with the words that changed
+void boardGeneration(Board* board)
+{
+	unsigned int numRows = board->numRows,
+				 numCols = board->numCols,
+				 wordsPerRow = board->wordsPerRow,
+				 numWords = wordsPerRow - 2;
+	uint64_t lastWordMask = (numCols % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (numCols % 64)) - 1;
+	fillBoardHalo(board);
+
+	for (unsigned int i=0; i < numRows; i++)
+	{
+		const uint64_t* row = board->bits.data() + (i + 1) * wordsPerRow;
+		uint64_t* out = board->nextBits.data() + (i + 1) * wordsPerRow;
+		bitRowNewState(row - wordsPerRow, row, row + wordsPerRow, out, numWords,
+					   board->birthMask, board->surviveMask);
+		out[numWords] &= lastWordMask;
+		if (frameBehavior == FRAME_DEAD)
+		{
+			if (i == 0 || i == numRows-1)
+				memset(out + 1, 0, numWords * sizeof(uint64_t));
+			out[1] &= ~((uint64_t) 1);
+			out[1 + (numCols-1) / 64] &= ~(((uint64_t) 1) << ((numCols-1) % 64));
+		}
+
+		for (unsigned int w=1; w <= numWords; w++)
+		{
+			uint64_t before = (w == numWords) ? row[w] & lastWordMask : row[w];
+			if (out[w] != before)
+				board->hash ^= gridWordHash((i + 1) * wordsPerRow + w, before) ^
+							   gridWordHash((i + 1) * wordsPerRow + w, out[w]);
+		}
+	}
+	board->bits.swap(board->nextBits);
+}
 
 
 #if 0
@@ -535,9 +3930,13 @@ void displayGridPane(void)
 
 	//---------------------------------------------------------
 	//	This is the call that makes OpenGL render the grid.
-	//
+	//	We draw the latest frame published by the threads, and
+	//	ask for a new one.
 	//---------------------------------------------------------
-	drawGrid(currentGrid2D, NUM_ROWS, NUM_COLS);
+	if (readyFrame & RENDER_FRESH)
+		frontFrame = readyFrame.exchange(frontFrame) & ~RENDER_FRESH;
+	frameRequested = true;
+	drawGrid(renderFrame[frontFrame], renderRows, renderCols);
 	
 	//	This is OpenGL/glut magic.
 	glutSwapBuffers();
@@ -554,6 +3953,18 @@ void displayStatePane(void)
 	glLoadIdentity();
 
 	drawState(numLiveThreads, threadSleepTime);
+
+	//	the statistics of the last generation
+	stringstream text;
+	drawStateLine(0, "generation " + to_string(generation));
+	drawStateLine(1, "population " + to_string(population));
+	drawStateLine(2, "births " + to_string(lastBirths) + "   deaths " + to_string(lastDeaths));
+	text << "activity";
+	for (unsigned int k = 0; k < NUM_THREADS && numLiveThreads > 0; k++)
+		text << " " << threadInfo[k].activity;
+	drawStateLine(3, text.str());
+	if (cyclePeriod != 0)
+		drawStateLine(4, "repeats every " + to_string(cyclePeriod) + " generations");
 	
 	//	This is OpenGL/glut magic.  Don't touch
 	glutSwapBuffers();
@@ -561,6 +3972,17 @@ void displayStatePane(void)
 }
 
 
+//	Writes a line of text in the state pane, below the state drawn by the
+//	front end
+void drawStateLine(unsigned int line, const string& text)
+{
+	glColor3f(1.f, 1.f, 1.f);
+	glRasterPos2i(STATE_TEXT_LEFT, STATE_TEXT_TOP + line * STATE_LINE_HEIGHT);
+	for (char c : text)
+		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
+}
+
+
 //	This callback function is called when a keyboard event occurs
 //
 void myKeyboardFunc(unsigned char c, int x, int y)
@@ -574,9 +3996,9 @@ void myKeyboardFunc(unsigned char c, int x, int y)
 			cleanupAndquit();
 			break;
 
-		//	spacebar --> resets the grid
+		//	spacebar --> resets the grid (at the end of the current generation)
 		case ' ':
-			resetGrid();
+			resetRequested = true;
 			break;
 
 		//	'+' --> increase simulation speed
@@ -593,31 +4015,35 @@ void myKeyboardFunc(unsigned char c, int x, int y)
 				threadSleepTime = maxThreadSleepTime;
 			break;
 
-		//	'1' --> apply Rule 1 (Game of Life: B23/S3)
+		//	'1' --> apply Rule 1 (Game of Life: B3/S23)
+		//	'2' --> apply Rule 2 (Coral: B3/S45678)
+		//	'3' --> apply Rule 3 (Amoeba: B357/S1358)
+		//	'4' --> apply Rule 4 (Maze: B3/S12345)
 		case '1':
-			rule = GAME_OF_LIFE_RULE;
-			break;
-
-		//	'2' --> apply Rule 2 (Coral: B3_S45678)
 		case '2':
-			rule = CORAL_GROWTH_RULE;
+		case '3':
+		case '4':
+			selectRule(c - '1');
 			break;
 
-		//	'3' --> apply Rule 3 (Amoeba: B357/S1358)
-		case '3':
-			rule = AMOEBA_RULE;
+		//	'r' --> apply the next rule of the list
+		case 'r':
+			selectRule((ruleListIndex + 1) % ruleList.size());
 			break;
 
-		//	'4' --> apply Rule 4 (Maze: B3/S12345)
-		case '4':
-			rule = MAZE_RULE;
+		//	'h' --> jump ahead 2^k generations (at the end of the current one)
+		case 'h':
+			hashLifeRequested = true;
 			break;
 
-		//	'c' --> toggles on/off color mode
+		//	'c' --> toggles on/off color mode (at the end of the current generation)
 		//	'b' --> toggles off/on color mode
 		case 'c':
 		case 'b':
-			colorMode = !colorMode;
+			//	the bit-packed grid has no room for a cell's age
+			if (bitPackedMode)
+				break;
+			colorModeRequested = true;
 			break;
 
 		//	'l' --> toggles on/off grid line rendering
@@ -637,51 +4063,334 @@ void myTimerFunc(int value)
 {
 	//	value not used.  Warning suppression
 	(void) value;
-	
 
-	bool isGenDone = false;
+	//	The threads advance the generations on their own, the timer only
+	//	refreshes the display
 	myDisplayFunc();
-	
-	//Wait for threads to finish then mark isGenDone as true to break
-	while(!isGenDone)
+
+	glutTimerFunc(100, myTimerFunc, 0);
+}
+
+
+//	Replaces the grid with a new initial grid.  While the computation threads
+//	run, they do it themselves at the end of the generation; otherwise a
+//	temporary team of NUM_THREADS threads fills the grid.
+void resetGrid(void)
+{
+	if (numLiveThreads > 0)
+	{
+		resetRequested = true;
+		return;
+	}
+	vector<ThreadInfo> team(NUM_THREADS);
+	for (unsigned int k = 0; k < NUM_THREADS; k++)
 	{
-		for(unsigned int i = 0; i < NUM_THREADS; ++i)
+		team[k].startRow = k * NUM_ROWS / NUM_THREADS;
+		team[k].endRow = (k + 1) * NUM_ROWS / NUM_THREADS;
+		int err = pthread_create(&team[k].threadID, NULL, resetThreadFunc, &team[k]);
+		if (err != 0)
 		{
-			if(threadInfo[i].complete == false)
-				break;
+			cout << "Unable to create thread " << k << ". [" << err << "]: " <<
+				strerror(err) << endl << flush;
+			exit(1);
 		}
-		isGenDone = true;
 	}
-	for(unsigned int i =0; i < NUM_THREADS; ++i)
-		threadInfo[i].complete = false;
+	uint64_t count = 0;
+	for (unsigned int k = 0; k < NUM_THREADS; k++)
+	{
+		pthread_join(team[k].threadID, NULL);
+		count += team[k].stats.population;
+	}
+	finishReset();
+	population = count;
+	lastBirths = 0;
+	lastDeaths = 0;
+}
 
-	//Generation done, we can continue
-	generation++;
+void* resetThreadFunc(void* arg)
+{
+	ThreadInfo* info = (ThreadInfo*) arg;
+	fillInitialRows(info->startRow, info->endRow, &info->stats);
+	return NULL;
+}
+
+//	Fills rows [startRow, endRow) of the next grid with the initial grid.
+//	The random cells are drawn 64 at a time, as the words of the bit grid,
+//	so that a given seed gives the same grid in scalar and bit-packed mode.
+//	The live cells are counted into stats->population.
+void fillInitialRows(unsigned int startRow, unsigned int endRow, CellStats* stats)
+{
+	uint64_t key = randomHash(randomSeed, RANDOM_STREAM_RESET);
+	unsigned int numWords = bitWordsPerRow - 2;
+	uint64_t lastWordMask = (NUM_COLS % 64 == 0) ? ~((uint64_t) 0) : (((uint64_t) 1) << (NUM_COLS % 64)) - 1;
+	vector<uint64_t> rowBits(bitWordsPerRow);
+	unsigned int rowOffset = (NUM_ROWS - patternRows) / 2,
+				 colOffset = (NUM_COLS - patternCols) / 2;
+
+	for (unsigned int i=startRow; i < endRow; i++)
+	{
+		uint64_t* bits = bitPackedMode ? nextBits + (i + 1) * bitWordsPerRow : rowBits.data();
+		memset(bits, 0, bitWordsPerRow * sizeof(uint64_t));
+		if (patternRuns.empty())
+		{
+			for (unsigned int w=1; w <= numWords; w++)
+				bits[w] = randomDensityWord(key, (numResets * NUM_ROWS + i) * numWords + w, densityLevel);
+			bits[numWords] &= lastWordMask;
+		}
+		else
+		{
+			for (const PatternRun& run : patternRuns)
+			{
+				if (run.row + rowOffset != i)
+					continue;
+				for (unsigned int j = colOffset + run.col; j < colOffset + run.col + run.length; j++)
+					bits[1 + j/64] |= ((uint64_t) 1) << (j % 64);
+			}
+		}
+		for (unsigned int w=1; w <= numWords; w++)
+			stats->population += __builtin_popcountll(bits[w]);
+
+		if (!bitPackedMode)
+		{
+			CellType* row = nextGrid2D[i];
+			for (unsigned int j=0; j < NUM_COLS; j++)
+				row[j] = (bits[1 + j/64] >> (j % 64)) & 1;
+			if (nextAge2D != NULL)
+				memcpy(nextAge2D[i], row, NUM_COLS * sizeof(CellType));
+		}
+	}
+}
+
+//	Installs the grid filled by fillInitialRows
+void finishReset(void)
+{
+	numResets++;
 	swapGrids();
-	glutTimerFunc(100, myTimerFunc, 0);
+	allTilesDirty = true;
+}
+
+//	Reads a Life pattern, in RLE or plaintext format, as runs of live cells.
+//	The header line of an RLE file may also give the rule of the pattern.
+void loadPattern(const char* fileName)
+{
+	ifstream file(fileName);
+	if (!file)
+	{
+		cout << "Could not read the pattern file " << fileName << endl;
+		exit(7);
+	}
+
+	string line;
+	bool rleFormat = false;
+	while (getline(file, line))
+	{
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos || line[start] == '#' || line[start] == '!')
+			continue;
+		rleFormat = (line[start] == 'x');
+		break;
+	}
+
+	patternRuns.clear();
+	unsigned int row = 0, col = 0;
+	if (rleFormat)
+	{
+		//	header: "x = <cols>, y = <rows>, rule = <rule>"
+		size_t rulePos = line.find("rule");
+		if (rulePos != string::npos)
+		{
+			string rule = line.substr(line.find('=', rulePos) + 1);
+			rule.erase(0, rule.find_first_not_of(" \t"));
+			//	a Larger-than-Life rule has commas, but is the last field
+			rule = rule.substr(0, rule.find_first_of(" \t\r"));
+			if (!rule.empty() && rule[0] != 'R' && rule[0] != 'r')
+				rule = rule.substr(0, rule.find(','));
+			RuleTable table;
+			if (!compileRule(rule.c_str(), &table))
+			{
+				cout << "Invalid rule " << rule << " in " << fileName << endl;
+				exit(7);
+			}
+			ruleList.push_back(rule);
+			ruleListIndex = ruleList.size() - 1;
+			ruleGiven = true;
+		}
+
+		//	body: <count><tag>, where the tag is b (dead cells), o (live
+		//	cells), $ (end of row) or ! (end of pattern)
+		unsigned int count = 0;
+		char c;
+		while (file.get(c) && c != '!')
+		{
+			if (c >= '0' && c <= '9')
+			{
+				count = 10 * count + (c - '0');
+				continue;
+			}
+			unsigned int length = max(count, 1U);
+			count = 0;
+			if (c == '$')
+			{
+				row += length;
+				col = 0;
+			}
+			else if (c == 'b' || c == '.')
+				col += length;
+			else if (isalpha(c))
+			{
+				patternRuns.push_back({row, col, length});
+				col += length;
+				patternCols = max(patternCols, col);
+			}
+			else if (c == '#')
+				getline(file, line);
+		}
+		patternRows = row + 1;
+	}
+	else
+	{
+		//	one line per row: 'O' (or '*') for a live cell, '.' for a dead one
+		do
+		{
+			if (line.size() > 0 && line[0] == '!')
+				continue;
+			for (col = 0; col < line.size(); col++)
+			{
+				if (line[col] != 'O' && line[col] != '*')
+					continue;
+				if (!patternRuns.empty() && patternRuns.back().row == row &&
+					patternRuns.back().col + patternRuns.back().length == col)
+					patternRuns.back().length++;
+				else
+					patternRuns.push_back({row, col, 1});
+				patternCols = max(patternCols, col + 1);
+			}
+			row++;
+		}
+		while (getline(file, line));
+		patternRows = row;
+	}
+	if (patternRuns.empty())
+	{
+		cout << "No live cell in the pattern file " << fileName << endl;
+		exit(7);
+	}
+}
+
+//	Color mode: all live cells become newborn cells
+void resetAges(void)
+{
+	if (currentAge2D == NULL)
+		return;
+	for (unsigned int i=0; i < NUM_ROWS; i++)
+		memcpy(currentAge2D[i], currentGrid2D[i], NUM_COLS * sizeof(CellType));
+}
+
+//	Run between two generations: allocates the age planes when color mode
+//	gets turned on, and releases them when it gets turned off
+void toggleColorMode(void)
+{
+	colorMode = !colorMode;
+	if (colorMode)
+	{
+		currentAge2D = newGrid2D<CellType>(NUM_ROWS, NUM_COLS);
+		nextAge2D = newGrid2D<CellType>(NUM_ROWS, NUM_COLS);
+		resetAges();
+	}
+	else
+	{
+		deleteGrid2D(currentAge2D);
+		deleteGrid2D(nextAge2D);
+		currentAge2D = nextAge2D = NULL;
+	}
+	allTilesDirty = true;
 }
 
+void initializeRenderFrames(void)
+{
+	renderBlockRows = (NUM_ROWS + displaySize - 1) / displaySize;
+	renderBlockCols = (NUM_COLS + displaySize - 1) / displaySize;
+	renderRows = (NUM_ROWS + renderBlockRows - 1) / renderBlockRows;
+	renderCols = (NUM_COLS + renderBlockCols - 1) / renderBlockCols;
+	for (unsigned int k=0; k < 3; k++)
+		renderFrame[k] = newGrid2D<unsigned int>(renderRows, renderCols);
+}
 
-void resetGrid()
+//	Fills rows [startRow, endRow) of the back frame with the current grid:
+//	each cell gets the largest value (age in color mode, state otherwise)
+//	of its block of cells, at most NB_COLORS-1 (a Generations rule can have
+//	more states than there are colors)
+void poolFrameRows(unsigned int startRow, unsigned int endRow)
 {
-	for (unsigned int i=0; i<NUM_ROWS; i++)
+	unsigned int** frame = renderFrame[backFrame];
+	CellType** source2D = (currentAge2D != NULL) ? currentAge2D : currentGrid2D;
+	for (unsigned int r=startRow; r < endRow; r++)
 	{
-		for (unsigned int j=0; j<NUM_ROWS; j++)
+		unsigned int* out = frame[r];
+		memset(out, 0, renderCols * sizeof(unsigned int));
+		for (unsigned int i = r * renderBlockRows; i < min((r + 1) * renderBlockRows, NUM_ROWS); i++)
 		{
-			nextGrid2D[i][j] = uniformDist(engine);
+			const uint64_t* bits = currentBits + (i + 1) * bitWordsPerRow + 1;
+			const CellType* row = bitPackedMode ? NULL : source2D[i];
+			for (unsigned int c=0, j=0; c < renderCols; c++)
+			{
+				unsigned int value = out[c];
+				unsigned int blockEnd = min(j + renderBlockCols, NUM_COLS);
+				if (bitPackedMode)
+				{
+					for (; j < blockEnd; j++)
+						value |= (bits[j/64] >> (j % 64)) & 1;
+				}
+				else
+				{
+					for (; j < blockEnd; j++)
+						value = max(value, (unsigned int) row[j]);
+					value = min(value, (unsigned int) NB_COLORS-1);
+				}
+				out[c] = value;
+			}
 		}
 	}
-	swapGrids();
+}
+
+//	Makes the back frame the latest complete frame, and takes the previous
+//	one (unless the display took it) to fill next
+void publishFrame(void)
+{
+	backFrame = readyFrame.exchange(backFrame | RENDER_FRESH) & ~RENDER_FRESH;
+}
+
+//	Allocates a grid with its halo, (numRows+2) x (numCols+2) cells in a
+//	single block, and the array of row pointers on top of it.  Both are
+//	shifted by one so that grid2D[i][j] is valid for i, j in [-1, size].
+template <typename CellT>
+CellT** newGrid2D(unsigned int numRows, unsigned int numCols)
+{
+	CellT* grid = new CellT[(numRows + 2) * (numCols + 2)]();
+	CellT** grid2D = new CellT*[numRows + 2] + 1;
+	grid2D[-1] = grid + 1;
+	for (int i=0; i<=(int) numRows; i++)
+		grid2D[i] = grid2D[i-1] + numCols + 2;
+	return grid2D;
+}
+
+template <typename CellT>
+void deleteGrid2D(CellT** grid2D)
+{
+	if (grid2D == NULL)
+		return;
+	delete [](grid2D[-1] - 1);
+	delete [](grid2D - 1);
 }
 
 //	This function swaps the current and next grids, as well as their
 //	companion 2D grid.  Note that we only swap the "top" layer of
-//	the 2D grids.
+//	the 2D grids.  The halo of the new current grid is then filled.
 void swapGrids(void)
 {
 	//	swap grids
-	unsigned int* tempGrid;
-	unsigned int** tempGrid2D;
+	CellType* tempGrid;
+	CellType** tempGrid2D;
 	
 	tempGrid = currentGrid;
 	currentGrid = nextGrid;
@@ -690,5 +4399,15 @@ void swapGrids(void)
 	tempGrid2D = currentGrid2D;
 	currentGrid2D = nextGrid2D;
 	nextGrid2D = tempGrid2D;
+	//
+	tempGrid2D = currentAge2D;
+	currentAge2D = nextAge2D;
+	nextAge2D = tempGrid2D;
+	//
+	uint64_t* tempBits = currentBits;
+	currentBits = nextBits;
+	nextBits = tempBits;
+
+	fillHalo();
 }
 
@@ -31,10 +31,14 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <cstring>
+#include <cstdint>
 #include <ctime>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <atomic>
 #include "gl_frontEnd.h"
 #include <random>
 
@@ -47,7 +51,9 @@ using namespace std;
 //==================================================================================
 #endif
 
-typedef struct ThreadInfo
+//	One per computation thread, on its own cache line since the timer polls
+//	the quiescent flags while the threads keep writing their counters
+typedef struct alignas(64) ThreadInfo
 {
 	//	you probably want these
 	pthread_t threadID;
@@ -55,8 +61,21 @@ typedef struct ThreadInfo
 	unsigned int startRow;
 	unsigned int endRow;
 	bool complete;
+	//	number of cell updates done by the thread
+	unsigned long long numUpdates;
+	//	async mode: true while the thread does not touch the grids
+	atomic<bool> quiescent;
 } ThreadInfo;
 
+//	A lock of the striped locking layer, which protects all the cells mapped
+//	to it.  The counters are only modified while holding the lock.
+typedef struct alignas(64) StripeLock
+{
+	pthread_mutex_t mutex;
+	unsigned long long numLocks;
+	unsigned long long numContended;	//	times the lock was already taken
+} StripeLock;
+
 
 #if 0
 //==================================================================================
@@ -71,6 +90,18 @@ void initializeApplication(unsigned int numRows, unsigned int numCols);
 void cleanupAndquit(void);
 void* threadFunc(void*);
 void swapGrids(void);
+void parseOptions(int argc, const char* argv[]);
+void initializeStripes(unsigned int numStripes);
+unsigned int cellStripe(unsigned int i, unsigned int j);
+void lockStripe(unsigned int stripe);
+void reportStripes(void);
+void updateLocked(ThreadInfo* info, unsigned int i, unsigned int j);
+void updateAsync(ThreadInfo* info, unsigned int i, unsigned int j);
+void pauseThreads(void);
+void resumeThreads(void);
+double currentTime(void);
+static inline uint64_t randomHash(uint64_t key, uint64_t counter);
+static inline unsigned int randomBelow(uint64_t random, unsigned int n);
 unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows, unsigned int numCols);
 
 
@@ -138,13 +169,43 @@ const unsigned int minThreadSleepTime = 10000;
 
 //Set up the thread and lock as global vars
 ThreadInfo* threadInfo;
-pthread_mutex_t** lockArr;
 
-//Set up a rendom engine
-random_device randDev;
-default_random_engine engine(randDev());
-uniform_int_distribution<unsigned int> uniformDist(0, 1);
-uniform_int_distribution<unsigned int> uniformDistLong(0,8);
+//	Locked mode: the cells are grouped in blocks of STRIPE_BLOCK x STRIPE_BLOCK
+//	cells, and the blocks are spread over numStripes locks (--stripes <n>), so
+//	that a neighborhood needs between one and four locks.  The locks of a
+//	neighborhood are always taken in increasing order, which cannot deadlock.
+#define STRIPE_BLOCK	8
+StripeLock* stripeLock;
+unsigned int numStripes = 1024;
+unsigned int numBlockCols;
+const char* stripeStatsFile = NULL;
+
+//	How the threads update a random cell:
+//		- locked: the locks of the cell and its neighbors are taken, and the
+//			timer takes all the locks to swap the grids
+//		- async (--async): the cell is written with an atomic store, which is
+//			all that is needed since the current grid is only read.  To swap
+//			the grids, the timer raises swapRequested and waits until every
+//			thread has reached a quiescent state (between two updates).
+#define UPDATE_LOCKED	0
+#define UPDATE_ASYNC	1
+unsigned int updateMode = UPDATE_LOCKED;
+atomic<bool> swapRequested(false);
+atomic<bool> stopRequested(false);
+
+//	start of the computation, to report the number of updates per second
+double startTime;
+
+//	Random numbers are counter-based (see randomHash): each thread draws the
+//	cells it updates from its own stream, which only depends on the seed
+//	(--seed <n>) and on the index of the thread, and a random value attached
+//	to a cell only depends on the seed and the position of the cell.
+#define RANDOM_STREAM_RESET		0
+#define RANDOM_STREAM_FRAME		1
+#define RANDOM_STREAM_THREAD	2	//	+ index of the thread
+uint64_t randomSeed;
+bool randomSeedGiven = false;
+uint64_t numResets = 0;
 
 //------------------------------
 //	Threads and synchronization
@@ -168,7 +229,7 @@ uniform_int_distribution<unsigned int> uniformDistLong(0,8);
 int main(int argc, const char* argv[])
 {
 	unsigned int numRow, numCol, numThread;
-	if(argc == 4)
+	if(argc >= 4)
 	{
 		stringstream ss;
 		ss << argv[1] << ' ' << argv[2] << ' ' << argv[3];
@@ -184,9 +245,21 @@ int main(int argc, const char* argv[])
 	}
 	else
 	{
-		cout << "Usage:" << argv[0] << " <Width> <Height> <Number of threads, must be less than height>" <<  endl;
+		cout << "Usage:" << argv[0] << " <Width> <Height> <Number of threads, must be less than height> [options]" <<  endl;
+		cout << "Options:" << endl;
+		cout << "\t--async\tlock-free updates, the grids are swapped once all threads are quiescent" << endl;
+		cout << "\t--seed <n>\tseed of the random numbers (default: a random seed)" << endl;
+		cout << "\t--stripes <n>\tnumber of locks shared by the cells, without --async (default 1024)" << endl;
+		cout << "\t--stripe-stats <file>\ton exit, write the use and contention of each lock to a CSV file" << endl;
 		exit(1);
 	}
+	parseOptions(argc, argv);
+	if (!randomSeedGiven)
+	{
+		random_device randDev;
+		randomSeed = ((uint64_t) randDev() << 32) | randDev();
+		cout << "random seed " << randomSeed << endl;
+	}
 	NUM_ROWS = numRow;
 	NUM_COLS = numCol;
 	NUM_THREADS = numThread;
@@ -196,14 +269,9 @@ int main(int argc, const char* argv[])
 	
 	//	Now we can do application-level initialization
 	initializeApplication(numRow, numCol);
-	lockArr = new pthread_mutex_t* [numRow];
-	//Create a 2D array of locks
-	for(unsigned int i = 0; i < numRow; ++i)
-	{
-		lockArr[i] = new pthread_mutex_t[numCol];
-		for(unsigned int j = 0; j < numRow; ++j)
-			pthread_mutex_init(&lockArr[i][j], NULL);
-	}
+	//Create the striped locks (only needed in locked mode)
+	if (updateMode == UPDATE_LOCKED)
+		initializeStripes(numStripes);
 
 
 	threadInfo = new ThreadInfo[numThread];
@@ -216,6 +284,7 @@ int main(int argc, const char* argv[])
 		chunkSize = 1 + NUM_ROWS/NUM_THREADS;
 		
 	//Create all the threads
+	startTime = currentTime();
 	for(unsigned int i = 0; i < NUM_THREADS; ++i)
 	{
 		threadInfo[i].startRow = i * chunkSize;
@@ -225,6 +294,8 @@ int main(int argc, const char* argv[])
 			threadInfo[i].endRow = NUM_ROWS;
 		threadInfo[i].threadIndex = i;
 		threadInfo[i].complete = false;
+		threadInfo[i].numUpdates = 0;
+		threadInfo[i].quiescent = true;
 		++numLiveThreads;
 		
 		int err = pthread_create(&threadInfo[i].threadID, NULL, threadFunc, threadInfo + i);
@@ -279,71 +350,249 @@ void initializeApplication(unsigned int numRows, unsigned int numCols)
 }
 
 
-void* threadFunc(void* arg)
+//	Reads the optional arguments that follow <Width> <Height> <Number of threads>
+void parseOptions(int argc, const char* argv[])
 {
-	ThreadInfo* info = (ThreadInfo*) arg;
-	uniform_int_distribution<int> uniformDistI(0, NUM_ROWS - 1);
-	uniform_int_distribution<int> uniformDistJ(0, NUM_COLS - 1);
-	int i;
-	int j;
-	//Have threads loop infinutely to be eventually terminated when the user hits esc
-	while(true)
+	for (int k = 4; k < argc; k++)
 	{
-		i = uniformDistI(engine);
-		j = uniformDistJ(engine);
-		//lock access
-		for(int k = i - 1; k < i + 2; ++k)
+		if (strcmp(argv[k], "--async") == 0)
 		{
-			if(k < 0 || k > (int) (NUM_ROWS - 1))
-				continue;
-			for(int l = j - 1; l < j +2; ++l)
+			updateMode = UPDATE_ASYNC;
+		}
+		else if (strcmp(argv[k], "--seed") == 0 && k+1 < argc)
+		{
+			randomSeed = strtoull(argv[++k], NULL, 10);
+			randomSeedGiven = true;
+		}
+		else if (strcmp(argv[k], "--stripes") == 0 && k+1 < argc)
+		{
+			numStripes = atoi(argv[++k]);
+			if (numStripes < 1)
 			{
-				if(l < 0 || l > (int) (NUM_COLS - 1))
-					continue;
-				cout << "about to lock (" << k << ", " << l <<")" << endl;
-				pthread_mutex_lock(&lockArr[k][l]);
-				cout << "Locked." << endl;
+				cout << "The number of stripes must be at least 1" << endl;
+				exit(3);
 			}
 		}
-		cout << "Access locked" << endl;
-		//Get the new state of each cell
-		unsigned int newState = cellNewState(i, j, NUM_ROWS, NUM_COLS);
-		
-		if(colorMode == 0 || newState == 0)
+		else if (strcmp(argv[k], "--stripe-stats") == 0 && k+1 < argc)
 		{
-			nextGrid2D[i][j] = newState;
+			stripeStatsFile = argv[++k];
 		}
 		else
 		{
-			if(currentGrid2D[i][j] < NB_COLORS-1)
-				nextGrid2D[i][j] = currentGrid2D[i][j] + 1;
-			else
-				nextGrid2D[i][j] = currentGrid2D[i][j];
+			cout << "Unknown option " << argv[k] << endl;
+			exit(3);
 		}
-		
-		cout << "Unlocking" << endl;
-		//Reopen for access
-		for(int k = i - 1; k < i + 2; ++k)
+	}
+}
+
+//	Counter-based random numbers (the SplitMix64 generator, evaluated at
+//	position counter of the stream that starts at key)
+static inline uint64_t randomHash(uint64_t key, uint64_t counter)
+{
+	uint64_t z = key + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//	Maps a random number to [0, n)
+static inline unsigned int randomBelow(uint64_t random, unsigned int n)
+{
+	return ((random >> 32) * n) >> 32;
+}
+
+double currentTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1.0E-9 * now.tv_nsec;
+}
+
+void* threadFunc(void* arg)
+{
+	ThreadInfo* info = (ThreadInfo*) arg;
+	uint64_t randomKey = randomHash(randomSeed, RANDOM_STREAM_THREAD + info->threadIndex);
+	uint64_t randomCounter = 0;
+	//	the thread sleeps after each batch of updates (as many as its band has cells)
+	unsigned int batchSize = (info->endRow - info->startRow) * NUM_COLS;
+
+	//Have threads loop until the user hits esc
+	info->quiescent = false;
+	while(!stopRequested)
+	{
+		for (unsigned int k = 0; k < batchSize && !stopRequested; k++)
 		{
-			if(k < 0 || k > (int) (NUM_ROWS - 1))
-				continue;
-			for (int l = j - 1; l < j +2; ++l)
+			//	async mode: stay out of the grids while they get swapped
+			if (swapRequested)
 			{
-				if(l < 0 || l > (int) (NUM_COLS - 1))
-					continue;
-				cout << "About to unlock (" << k << ", " << l <<")" << endl;
-				pthread_mutex_unlock(&lockArr[k][l]);
-				cout << "Unlocked." << endl;
+				info->quiescent = true;
+				while (swapRequested && !stopRequested)
+					sched_yield();
+				//	(the store must be visible before we look at swapRequested again)
+				info->quiescent = false;
+				continue;
 			}
+			uint64_t random = randomHash(randomKey, randomCounter++);
+			unsigned int i = randomBelow(random, NUM_ROWS);
+			unsigned int j = randomBelow(random << 32, NUM_COLS);
+			if (updateMode == UPDATE_ASYNC)
+				updateAsync(info, i, j);
+			else
+				updateLocked(info, i, j);
 		}
-		cout << "Work Complete swapping grids ..." << endl;
-		
+		info->quiescent = true;
 		usleep(threadSleepTime);
-		cout << "Done waiting returning to top" << endl;
+		info->quiescent = false;
 	}
+	info->quiescent = true;
 	return NULL;
 }
 
+//	Computes the next state of cell (i, j), given its new state
+static inline unsigned int nextCellValue(unsigned int i, unsigned int j, unsigned int newState)
+{
+	if(colorMode == 0 || newState == 0)
+		return newState;
+	if(currentGrid2D[i][j] < NB_COLORS-1)
+		return currentGrid2D[i][j] + 1;
+	return currentGrid2D[i][j];
+}
+
+void initializeStripes(unsigned int numStripes)
+{
+	numBlockCols = (NUM_COLS + STRIPE_BLOCK - 1) / STRIPE_BLOCK;
+	stripeLock = new StripeLock[numStripes];
+	for (unsigned int k = 0; k < numStripes; k++)
+	{
+		pthread_mutex_init(&stripeLock[k].mutex, NULL);
+		stripeLock[k].numLocks = 0;
+		stripeLock[k].numContended = 0;
+	}
+}
+
+//	The stripe of the block that contains cell (i, j)
+unsigned int cellStripe(unsigned int i, unsigned int j)
+{
+	return ((i / STRIPE_BLOCK) * numBlockCols + j / STRIPE_BLOCK) % numStripes;
+}
+
+void lockStripe(unsigned int stripe)
+{
+	StripeLock* lock = stripeLock + stripe;
+	bool contended = pthread_mutex_trylock(&lock->mutex) != 0;
+	if (contended)
+		pthread_mutex_lock(&lock->mutex);
+	lock->numLocks++;
+	lock->numContended += contended;
+}
+
+//	Locked mode: updates cell (i, j) with the stripes of its neighborhood locked
+void updateLocked(ThreadInfo* info, unsigned int i, unsigned int j)
+{
+	//	the stripes of the neighborhood, sorted and without duplicates
+	unsigned int stripes[9];
+	unsigned int numLocks = 0;
+	for(int k = (int) i - 1; k < (int) i + 2; ++k)
+	{
+		if(k < 0 || k > (int) (NUM_ROWS - 1))
+			continue;
+		for(int l = (int) j - 1; l < (int) j + 2; ++l)
+		{
+			if(l < 0 || l > (int) (NUM_COLS - 1))
+				continue;
+			unsigned int stripe = cellStripe(k, l);
+			unsigned int m = numLocks;
+			while (m > 0 && stripes[m-1] > stripe)
+				m--;
+			if (m > 0 && stripes[m-1] == stripe)
+				continue;
+			memmove(stripes + m + 1, stripes + m, (numLocks - m) * sizeof(unsigned int));
+			stripes[m] = stripe;
+			numLocks++;
+		}
+	}
+
+	//lock access
+	for (unsigned int m = 0; m < numLocks; m++)
+		lockStripe(stripes[m]);
+
+	//Get the new state of each cell
+	nextGrid2D[i][j] = nextCellValue(i, j, cellNewState(i, j, NUM_ROWS, NUM_COLS));
+	info->numUpdates++;
+
+	//Reopen for access
+	for (unsigned int m = numLocks; m > 0; m--)
+		pthread_mutex_unlock(&stripeLock[stripes[m-1]].mutex);
+}
+
+//	Prints how often the locks were taken and found already taken, and
+//	writes the counters of each stripe to the --stripe-stats file
+void reportStripes(void)
+{
+	unsigned long long numLocks = 0, numContended = 0;
+	unsigned int worstStripe = 0;
+	for (unsigned int k = 0; k < numStripes; k++)
+	{
+		numLocks += stripeLock[k].numLocks;
+		numContended += stripeLock[k].numContended;
+		if (stripeLock[k].numContended > stripeLock[worstStripe].numContended)
+			worstStripe = k;
+	}
+	cout << numStripes << " stripes: " << numLocks << " locks, " << numContended << " contended ("
+		 << (numLocks != 0 ? 100.0 * numContended / numLocks : 0.0) << "%), most contended stripe "
+		 << worstStripe << " (" << stripeLock[worstStripe].numContended << ")" << endl;
+
+	if (stripeStatsFile != NULL)
+	{
+		ofstream statsFile(stripeStatsFile);
+		statsFile << "stripe,locks,contended" << endl;
+		for (unsigned int k = 0; k < numStripes; k++)
+			statsFile << k << "," << stripeLock[k].numLocks << "," << stripeLock[k].numContended << endl;
+		if (!statsFile)
+			cout << "Could not write " << stripeStatsFile << endl;
+	}
+}
+
+//	Async mode: the current grid is only written while all threads are
+//	quiescent, so it can be read freely.  Two threads may pick the same cell
+//	and write it at the same time (with the same value), hence the atomic store.
+void updateAsync(ThreadInfo* info, unsigned int i, unsigned int j)
+{
+	unsigned int value = nextCellValue(i, j, cellNewState(i, j, NUM_ROWS, NUM_COLS));
+	__atomic_store_n(&nextGrid2D[i][j], value, __ATOMIC_RELAXED);
+	info->numUpdates++;
+}
+
+//	Stops all updates of the grids, until resumeThreads is called
+void pauseThreads(void)
+{
+	if (updateMode == UPDATE_ASYNC)
+	{
+		swapRequested = true;
+		for (unsigned int i = 0; i < NUM_THREADS; i++)
+		{
+			while (!threadInfo[i].quiescent)
+				sched_yield();
+		}
+	}
+	else
+	{
+		for (unsigned int k = 0; k < numStripes; k++)
+			lockStripe(k);
+	}
+}
+
+void resumeThreads(void)
+{
+	if (updateMode == UPDATE_ASYNC)
+		swapRequested = false;
+	else
+	{
+		for (unsigned int k = numStripes; k > 0; k--)
+			pthread_mutex_unlock(&stripeLock[k-1].mutex);
+	}
+}
+
 
 //	This is the function that determines how a cell update its state
 unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows, unsigned int numCols)
@@ -375,7 +624,9 @@ unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows,
 		
 		#elif FRAME_BEHAVIOR == FRAME_RANDOM
 		
-			count = uniformDistLong(engine);
+			//	the same count for all updates of the cell in this generation
+			uint64_t counter = ((uint64_t) generation * numRows + i) * numCols + j;
+			count = randomBelow(randomHash(randomHash(randomSeed, RANDOM_STREAM_FRAME), counter), 9);
 		#elif FRAME_BEHAVIOR == FRAME_CLIPPED
 	
 			if (i>0)
@@ -514,13 +765,18 @@ unsigned int cellNewState(unsigned int i, unsigned int j, unsigned int numRows,
 
 void cleanupAndquit(void)
 {
-	//	join the threads
+	//	stop and join the threads
+	stopRequested = true;
+	unsigned long long numUpdates = 0;
 	for(unsigned int i = 0; i < NUM_THREADS; i++)
 	{
 		if(!threadInfo[i].complete)
 			pthread_join(threadInfo[i].threadID, NULL);
-		
+		numUpdates += threadInfo[i].numUpdates;
 	}
+	cout << numUpdates << " cell updates, " << numUpdates / (currentTime() - startTime) << " updates/s" << endl;
+	if (updateMode == UPDATE_LOCKED)
+		reportStripes();
 	//	free the grids
 	free(currentGrid2D);
 	free(currentGrid);
@@ -595,7 +851,9 @@ void myKeyboardFunc(unsigned char c, int x, int y)
 
 		//	spacebar --> resets the grid
 		case ' ':
+			pauseThreads();
 			resetGrid();
+			resumeThreads();
 			break;
 
 		//	'+' --> increase simulation speed
@@ -660,23 +918,12 @@ void myTimerFunc(int value)
 	//myDisplayFunc();
     	
 
-	//Lock the board then swap and display then unlock it
-	for(unsigned int i = 0; i < NUM_ROWS; ++i)
-	{
-		for(unsigned int j = 0; j < NUM_COLS; ++j)
-		{
-			pthread_mutex_lock(&lockArr[i][j]);
-		}
-	}
+	//Stop the threads then swap and display then let them go
+	pauseThreads();
 	swapGrids();
+	generation++;
 	//glutPostRedisplay();
-	for(unsigned int i = 0; i < NUM_ROWS; ++i)
-	{
-		for(unsigned int j = 0; j < NUM_COLS; ++j)
-		{
-			pthread_mutex_unlock(&lockArr[i][j]);
-		}
-	}
+	resumeThreads();
 //	And finally I perform the rendering
 	glutTimerFunc(100, myTimerFunc, 0);
 }
@@ -684,13 +931,16 @@ void myTimerFunc(int value)
 
 void resetGrid()
 {
+	uint64_t key = randomHash(randomSeed, RANDOM_STREAM_RESET);
 	for (unsigned int i=0; i<NUM_ROWS; i++)
 	{
-		for (unsigned int j=0; j<NUM_ROWS; j++)
+		for (unsigned int j=0; j<NUM_COLS; j++)
 		{
-			nextGrid2D[i][j] = uniformDist(engine);
+			uint64_t counter = (numResets * NUM_ROWS + i) * NUM_COLS + j;
+			nextGrid2D[i][j] = randomHash(key, counter) >> 63;
 		}
 	}
+	numResets++;
 	swapGrids();
 }
 
@@ -4,7 +4,13 @@
 #include <math.h>
 #include "common.h"
 #include <vector>
+#include <string.h>
 #include "omp.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 
 /**
@@ -17,6 +23,324 @@
       forces between each other.
 **/
 
+//  Constants of the force (the same as apply_force in common.cpp)
+static const double CUTOFF = 0.01;
+static const double MASS = 0.01;
+static const double MIN_R = CUTOFF / 100;
+
+//  Shortest range of particles worth the vectorized loop: at the density of
+//  the simulation a bin holds 0.2 particles on average, and the branches of
+//  the scalar loop (most of the candidates are beyond the cutoff) are faster
+//  on the 1 or 2 particles of a typical row of neighbor bins
+static const int SIMD_MIN_RANGE = 8;
+
+//
+//  Force on particle k from the particles [first, last), for positions
+//  stored as arrays x, y in bin order (structure of arrays).  Computes the
+//  same forces and statistics as apply_force, but keeps the smallest
+//  squared distance in minR2 instead of dmin.  The loop is vectorized by
+//  the compiler for the target instruction set (AVX2 with -mavx2, AVX-512
+//  with -mavx512f, plain scalar code otherwise).
+//
+static void bin_force_simd( const double *x, const double *y, int k, int first, int last,
+                            double *fx, double *fy, double *minR2, double *davg, int *navg )
+{
+    double xk = x[k], yk = y[k];
+    double sumX = 0.0, sumY = 0.0, sumD = 0.0, localMin = *minR2;
+    int count = 0;
+#pragma omp simd reduction(+:sumX,sumY,sumD,count) reduction(min:localMin)
+    for( int j = first; j < last; j++ )
+    {
+        double dx = x[j] - xk;
+        double dy = y[j] - yk;
+        double r2 = dx * dx + dy * dy;
+        bool inside = r2 <= CUTOFF * CUTOFF;
+        bool counted = inside && r2 != 0;
+        localMin = fmin( localMin, counted ? r2 : CUTOFF * CUTOFF );
+        sumD += counted ? sqrt( r2 ) / CUTOFF : 0.0;
+        count += counted;
+        r2 = fmax( r2, MIN_R * MIN_R );
+        double coef = inside ? ( 1 - CUTOFF / sqrt( r2 ) ) / r2 / MASS : 0.0;
+        sumX += coef * dx;
+        sumY += coef * dy;
+    }
+    *fx += sumX;
+    *fy += sumY;
+    *minR2 = localMin;
+    *davg += sumD;
+    *navg += count;
+}
+
+//
+//  The same for a short range, with the branches of apply_force: most of
+//  the candidates are beyond the cutoff, and skipping them is faster than
+//  computing them in vectors
+//
+static inline void bin_force( const double *x, const double *y, int k, int first, int last,
+                              double *fx, double *fy, double *minR2, double *davg, int *navg )
+{
+    if( last - first >= SIMD_MIN_RANGE )
+    {
+        bin_force_simd( x, y, k, first, last, fx, fy, minR2, davg, navg );
+        return;
+    }
+    for( int j = first; j < last; j++ )
+    {
+        double dx = x[j] - x[k];
+        double dy = y[j] - y[k];
+        double r2 = dx * dx + dy * dy;
+        if( r2 > CUTOFF * CUTOFF )
+            continue;
+        if( r2 != 0 )
+        {
+            *minR2 = fmin( *minR2, r2 );
+            *davg += sqrt( r2 ) / CUTOFF;
+            (*navg)++;
+        }
+        r2 = fmax( r2, MIN_R * MIN_R );
+        double coef = ( 1 - CUTOFF / sqrt( r2 ) ) / r2 / MASS;
+        *fx += coef * dx;
+        *fy += coef * dy;
+    }
+}
+
+//
+//  Half-shell version of bin_force: each pair (k, j) of the range is
+//  computed once, and the opposite force is applied to j (Newton's third
+//  law).  Forces accumulate in the arrays ax, ay in bin order, and a pair
+//  counts twice in the statistics, as both particles would have counted it.
+//
+static void bin_force_half( const double *x, const double *y, double *ax, double *ay, int k, int first, int last,
+                            double *minR2, double *davg, int *navg )
+{
+    double xk = x[k], yk = y[k];
+    double sumX = 0.0, sumY = 0.0, sumD = 0.0, localMin = *minR2;
+    int count = 0;
+#pragma omp simd reduction(+:sumX,sumY,sumD,count) reduction(min:localMin) if(last - first >= SIMD_MIN_RANGE)
+    for( int j = first; j < last; j++ )
+    {
+        double dx = x[j] - xk;
+        double dy = y[j] - yk;
+        double r2 = dx * dx + dy * dy;
+        if( r2 > CUTOFF * CUTOFF )
+            continue;
+        if( r2 != 0 )
+        {
+            localMin = fmin( localMin, r2 );
+            sumD += 2 * sqrt( r2 ) / CUTOFF;
+            count += 2;
+        }
+        r2 = fmax( r2, MIN_R * MIN_R );
+        double coef = ( 1 - CUTOFF / sqrt( r2 ) ) / r2 / MASS;
+        sumX += coef * dx;
+        sumY += coef * dy;
+        ax[j] -= coef * dx;
+        ay[j] -= coef * dy;
+    }
+    ax[k] += sumX;
+    ay[k] += sumY;
+    *minR2 = localMin;
+    *davg += sumD;
+    *navg += count;
+}
+
+//
+//  Verlet list version of bin_force: the force on particle k from the
+//  particles list[first] .. list[last-1] (positions in bin order)
+//
+static inline void list_force( const double *x, const double *y, int k, const int *list, int first, int last,
+                               double *fx, double *fy, double *minR2, double *davg, int *navg )
+{
+    for( int l = first; l < last; l++ )
+    {
+        double dx = x[list[l]] - x[k];
+        double dy = y[list[l]] - y[k];
+        double r2 = dx * dx + dy * dy;
+        if( r2 > CUTOFF * CUTOFF )
+            continue;
+        if( r2 != 0 )
+        {
+            *minR2 = fmin( *minR2, r2 );
+            *davg += sqrt( r2 ) / CUTOFF;
+            (*navg)++;
+        }
+        r2 = fmax( r2, MIN_R * MIN_R );
+        double coef = ( 1 - CUTOFF / sqrt( r2 ) ) / r2 / MASS;
+        *fx += coef * dx;
+        *fy += coef * dy;
+    }
+}
+
+//
+//  The particles (positions in bin order) within range of particle k, in
+//  bin (r, c), searched in the 5x5 bins around it.  Writes them to list
+//  unless it is NULL, and returns how many there are.
+//
+static int verlet_neighbors( const double *x, const double *y, int k, const int *binStart, int numCells,
+                             int r, int c, double range, int *list )
+{
+    int count = 0;
+    for( int i = max( r - 2, 0 ); i <= min( r + 2, numCells - 1 ); i++ )
+    {
+        int last = binStart[i * numCells + min( c + 3, numCells )];
+        for( int j = binStart[i * numCells + max( c - 2, 0 )]; j < last; j++ )
+        {
+            double dx = x[j] - x[k];
+            double dy = y[j] - y[k];
+            if( j == k || dx * dx + dy * dy > range * range )
+                continue;
+            if( list )
+                list[count] = j;
+            count++;
+        }
+    }
+    return count;
+}
+
+//
+//  Exclusive prefix sum of counts[0] .. counts[m-1] into starts[0] ..
+//  starts[m], called by all the threads of a parallel region: each thread
+//  sums a block of counts, then scans it from the total of the blocks before
+//  it (blockSum has a slot per thread, plus one).  counts and starts can be
+//  the same array.
+//
+static void prefix_sum( const int *counts, int *starts, int m, int *blockSum )
+{
+    int thread = omp_get_thread_num(), numThreads = omp_get_num_threads();
+    int first = (int) ((long) m * thread / numThreads);
+    int last = (int) ((long) m * (thread + 1) / numThreads);
+    int count = 0;
+    for( int b = first; b < last; b++ )
+        count += counts[b];
+    blockSum[thread + 1] = count;
+#pragma omp barrier
+#pragma omp single
+    {
+        blockSum[0] = 0;
+        for( int t = 1; t <= numThreads; t++ )
+            blockSum[t] += blockSum[t - 1];
+        starts[m] = blockSum[numThreads];
+    }
+    int offset = blockSum[thread];
+    for( int b = first; b < last; b++ )
+    {
+        count = counts[b];
+        starts[b] = offset;
+        offset += count;
+    }
+#pragma omp barrier
+}
+
+//
+//  Morton code of bin (xBin, yBin): the bits of the two coordinates
+//  interleaved, so that bins close on the Z-shaped curve are close in space
+//
+static inline unsigned int spread_bits( unsigned int v )
+{
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+static inline unsigned int morton_code( int xBin, int yBin )
+{
+    return spread_bits( xBin ) | (spread_bits( yBin ) << 1);
+}
+
+//
+//  Sorts keys[0] .. keys[n-1], below 2^bits, and their values by a parallel
+//  LSD radix sort of 8-bit digits.  Called by all the threads of a parallel
+//  region: each thread counts the digits of a block of keys (histogram has
+//  256 slots per thread), then scatters the block in order, which keeps the
+//  sort stable.  tempKeys and tempValues are scratch arrays of n elements.
+//
+static void radix_sort( unsigned int *keys, int *values, unsigned int *tempKeys, int *tempValues,
+                        int n, int bits, int *histogram )
+{
+    int thread = omp_get_thread_num(), numThreads = omp_get_num_threads();
+    int first = (int) ((long) n * thread / numThreads);
+    int last = (int) ((long) n * (thread + 1) / numThreads);
+    int *counts = histogram + 256 * thread;
+    for( int shift = 0; shift < bits; shift += 8 )
+    {
+        memset( counts, 0, 256 * sizeof(int) );
+        for( int i = first; i < last; i++ )
+            counts[(keys[i] >> shift) & 0xff]++;
+#pragma omp barrier
+#pragma omp single
+        {
+            //  offsets: by digit, then by thread within a digit
+            int offset = 0;
+            for( int d = 0; d < 256; d++ )
+                for( int t = 0; t < numThreads; t++ )
+                {
+                    int count = histogram[256 * t + d];
+                    histogram[256 * t + d] = offset;
+                    offset += count;
+                }
+        }
+        for( int i = first; i < last; i++ )
+        {
+            int slot = counts[(keys[i] >> shift) & 0xff]++;
+            tempKeys[slot] = keys[i];
+            tempValues[slot] = values[i];
+        }
+#pragma omp barrier
+        unsigned int *swapKeys = keys;
+        keys = tempKeys;
+        tempKeys = swapKeys;
+        int *swapValues = values;
+        values = tempValues;
+        tempValues = swapValues;
+    }
+    //  an odd number of passes leaves the result in the scratch arrays
+    if( ((bits + 7) / 8) % 2 == 1 )
+    {
+        for( int i = first; i < last; i++ )
+        {
+            tempKeys[i] = keys[i];
+            tempValues[i] = values[i];
+        }
+#pragma omp barrier
+    }
+}
+
+//
+//  -misses: a counter of the cache misses of the calling thread (Linux
+//  only), or -1 if the system does not have one
+//
+static int open_miss_counter( void )
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+#else
+    return -1;
+#endif
+}
+
+static long long read_miss_counter( int fd )
+{
+    if( fd < 0 )
+        return -1;
+    long long count = -1;
+#ifdef __linux__
+    if( read( fd, &count, sizeof(count) ) != sizeof(count) )
+        count = -1;
+    close( fd );
+#endif
+    return count;
+}
+
 //
 //  benchmarking program
 //
@@ -33,6 +357,13 @@ int main( int argc, char **argv )
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" );
         printf( "-no turns off all correctness checks and particle output\n");
+        printf( "-scalar computes the forces with apply_force on the bins instead of the arrays in bin order\n");
+        printf( "-half computes each pair of particles once (half shell of neighbor bins)\n");
+        printf( "-verlet <skin> uses neighbor lists of range cutoff + skin (skin as a fraction of the cutoff),\n"
+                "   rebuilt when a particle moved more than skin/2\n");
+        printf( "   (-scalar, -half and -verlet are different force loops: give at most one of them)\n");
+        printf( "-reorder <int> sorts the particles along a Morton curve of their bins every <int> steps\n");
+        printf( "-misses counts the cache misses of the simulation (Linux)\n");
         return 0;
     }
     
@@ -43,11 +374,118 @@ int main( int argc, char **argv )
     
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
+    bool scalar = find_option( argc, argv, "-scalar" ) >= 0;
+    bool half = find_option( argc, argv, "-half" ) >= 0;
+    bool verlet = find_option( argc, argv, "-verlet" ) >= 0;
+    char *skinOption = read_string( argc, argv, "-verlet", NULL );
+    char *skinEnd = NULL;
+    double skin = skinOption ? strtod( skinOption, &skinEnd ) * CUTOFF : 0.0;
+    int reorderEvery = read_int( argc, argv, "-reorder", 0 );
+    bool countMisses = find_option( argc, argv, "-misses" ) >= 0;
+
+    if( scalar + half + verlet > 1 )
+    {
+        printf( "-scalar, -half and -verlet cannot be used together\n" );
+        return 1;
+    }
+    if( verlet && (skinOption == NULL || skinEnd == skinOption || *skinEnd != '\0') )
+    {
+        printf( "-verlet needs a skin, as a fraction of the cutoff (e.g. -verlet 0.3)\n" );
+        return 1;
+    }
 
     particle_t *particles = (particle_t*) malloc( n * sizeof(particle_t) );
     set_size( n );
     init_particles( n, particles );
     
+    //
+    //  cell list: the particle indices sorted by bin (counting sort), rebuilt
+    //  every step in place.  The particles of bin b are
+    //  binParticles[binStart[b]] .. binParticles[binStart[b+1]-1].  The bins
+    //  are at least as wide as the cutoff, so the neighbors of a particle are
+    //  all in the 3x3 bins around its own.
+    //
+    double size = sqrt(n * 0.0005);
+    int numCells = max(1, (int) floor(size / CUTOFF));
+    int numBins = numCells * numCells;
+    double cellSize = size / numCells;
+
+    //  the lists are searched in the 5x5 bins around a particle
+    if( verlet && (skin <= 0 || CUTOFF + skin > 2 * cellSize) )
+    {
+        printf( "The skin must be more than 0 and at most %g\n", (2 * cellSize - CUTOFF) / CUTOFF );
+        return 1;
+    }
+
+    int *binStart = (int*) malloc( (numBins + 1) * sizeof(int) );
+    int *binFill = (int*) malloc( numBins * sizeof(int) );
+    int *binParticles = (int*) malloc( n * sizeof(int) );
+    int *particleBin = (int*) malloc( n * sizeof(int) );
+    //  blockSum[t+1]: total of the block of counts of thread t in a prefix sum
+    int *blockSum = (int*) malloc( (omp_get_max_threads() + 1) * sizeof(int) );
+
+    //  positions in bin order for the vectorized kernel: the particles of a
+    //  row of 3 neighboring bins are contiguous
+    double *binX = (double*) aligned_alloc( 64, ((n + 7) / 8) * 8 * sizeof(double) );
+    double *binY = (double*) aligned_alloc( 64, ((n + 7) / 8) * 8 * sizeof(double) );
+    //  -half: accelerations in bin order
+    double *binAX = (double*) aligned_alloc( 64, ((n + 7) / 8) * 8 * sizeof(double) );
+    double *binAY = (double*) aligned_alloc( 64, ((n + 7) / 8) * 8 * sizeof(double) );
+
+    //
+    //  -verlet: the neighbors of the particle at position k in bin order are
+    //  neighbors[neighborStart[k]] .. neighbors[neighborStart[k+1]-1] (CSR),
+    //  kept with the bin order until a particle moves more than skin/2 from
+    //  where it was at the last rebuild (rebuildX, rebuildY)
+    //
+    int *neighborStart = (int*) malloc( (n + 1) * sizeof(int) );
+    int *neighbors = NULL;
+    int neighborCapacity = 0;
+    double *rebuildX = (double*) malloc( n * sizeof(double) );
+    double *rebuildY = (double*) malloc( n * sizeof(double) );
+    bool rebuild = true;
+    int numRebuilds = 0;
+    double maxMove2 = 0.0;
+
+    //
+    //  -reorder: the particles are kept in the order of the Morton codes of
+    //  their bins, so that the particles of nearby bins are close in memory.
+    //  original[i] is the index in the initial order of the particle now at
+    //  i: the bins are sorted by it, so that the forces are summed in the
+    //  same order as without reordering, and save() writes the initial order.
+    //
+    int *original = (int*) malloc( n * sizeof(int) );
+    for( int i = 0; i < n; i++ )
+        original[i] = i;
+    int mortonBits = 0;
+    while( (1 << (mortonBits / 2)) < numCells )
+        mortonBits += 2;
+    unsigned int *sortKeys = NULL, *tempKeys = NULL;
+    int *sortValues = NULL, *tempValues = NULL, *histogram = NULL, *reorderedOriginal = NULL;
+    particle_t *reordered = NULL, *saved = NULL;
+    if( reorderEvery > 0 )
+    {
+        sortKeys = (unsigned int*) malloc( n * sizeof(unsigned int) );
+        tempKeys = (unsigned int*) malloc( n * sizeof(unsigned int) );
+        sortValues = (int*) malloc( n * sizeof(int) );
+        tempValues = (int*) malloc( n * sizeof(int) );
+        histogram = (int*) malloc( 256 * omp_get_max_threads() * sizeof(int) );
+        reorderedOriginal = (int*) malloc( n * sizeof(int) );
+        reordered = (particle_t*) malloc( n * sizeof(particle_t) );
+        if( fsave )
+            saved = (particle_t*) malloc( n * sizeof(particle_t) );
+    }
+
+    //  -misses: one counter per thread of the team
+    int *missCounters = (int*) malloc( omp_get_max_threads() * sizeof(int) );
+    long long misses = 0;
+    bool missesAvailable = true;
+    if( countMisses )
+    {
+#pragma omp parallel
+        missCounters[omp_get_thread_num()] = open_miss_counter( );
+    }
+
     //
     //  simulate a number of time steps
     //
@@ -60,73 +498,232 @@ int main( int argc, char **argv )
 	navg = 0;
         davg = 0.0;
 	dmin = 1.0;
-        
-	//Get some variables we will use for binning
-    	double size = sqrt(n * 0.0005);
+	maxMove2 = 0.0;
 
-    	// we are gonna create bins as a numCell by numCell matrix and allocate each bin
-    	int numCells = (int) ceil(size / 0.01);
-    	std::vector<particle_t*> partBins[numCells][numCells];
-    	for(int i = 0; i < numCells; ++i)
-	    	for(int j = 0; j < numCells; ++j)
-		    partBins[i][j] = std::vector<particle_t*>();
+	//Start Parallel Section
+#pragma omp parallel
+	{
+	//Figure out how many threads we have for later
+	numThreads = omp_get_num_threads();
 
-    	double cellSize = size / numCells;
+	//
+	//  reorder the particles along the Morton curve
+	//
+	if(reorderEvery > 0 && step % reorderEvery == 0)
+	{
+#pragma omp for
+	for(int i = 0; i < n; ++i)
+	{
+	    int xBin = min((int) (particles[i].x / cellSize), numCells - 1);
+	    int yBin = min((int) (particles[i].y / cellSize), numCells - 1);
+	    sortKeys[i] = morton_code(xBin, yBin);
+	    sortValues[i] = i;
+	}
+	radix_sort(sortKeys, sortValues, tempKeys, tempValues, n, mortonBits, histogram);
+#pragma omp for
+	for(int i = 0; i < n; ++i)
+	{
+	    reordered[i] = particles[sortValues[i]];
+	    reorderedOriginal[i] = original[sortValues[i]];
+	}
+#pragma omp single
+	{
+	    particle_t *swapParticles = particles;
+	    particles = reordered;
+	    reordered = swapParticles;
+	    int *swapOriginal = original;
+	    original = reorderedOriginal;
+	    reorderedOriginal = swapOriginal;
+	    //  the positions of the last rebuild are in the old order
+	    rebuild = true;
+	}
+	}
 
-    	// We can now fill this matrix with particles
-    	for(int i = 0; i < n; ++i)
+	//
+	//  bin the particles (with -verlet, only to rebuild the lists)
+	//
+	if(!verlet || rebuild)
+	{
+#pragma omp for
+	for(int b = 0; b < numBins; ++b)
+	    binFill[b] = 0;
+
+	// Count the particles of each bin (a particle on the upper edge goes in the last bin)
+#pragma omp for
+	for(int i = 0; i < n; ++i)
 	{
-	   int xBin = floor(particles[i].x / cellSize);
-    	   int yBin = floor(particles[i].y / cellSize);
+	    int xBin = min((int) (particles[i].x / cellSize), numCells - 1);
+	    int yBin = min((int) (particles[i].y / cellSize), numCells - 1);
+	    particleBin[i] = yBin * numCells + xBin;
+#pragma omp atomic
+	    binFill[particleBin[i]]++;
+	}
 
-    	   //Add this particle to (xBin, yBin)
-    	   partBins[yBin][xBin].push_back(&particles[i]);
+	prefix_sum(binFill, binStart, numBins, blockSum);
+
+	// Scatter the particle indices into their bins (binFill counts down to 0)
+#pragma omp for
+	for(int i = 0; i < n; ++i)
+	{
+	    int slot;
+#pragma omp atomic capture
+	    slot = --binFill[particleBin[i]];
+	    binParticles[binStart[particleBin[i]] + slot] = i;
+	}
+
+	// The order of a bin depends on the timing of the threads: sort the
+	// (few) particles of each bin by their initial index so that the forces
+	// are always summed in the same order
+#pragma omp for schedule(static, 4096)
+	for(int b = 0; b < numBins; ++b)
+	{
+	    for(int k = binStart[b] + 1; k < binStart[b + 1]; ++k)
+	    {
+		int i = binParticles[k], l = k;
+		for(; l > binStart[b] && original[binParticles[l - 1]] > original[i]; --l)
+		    binParticles[l] = binParticles[l - 1];
+		binParticles[l] = i;
+	    }
+	}
+	}
+
+	// Copy the positions in bin order
+#pragma omp for
+	for(int k = 0; k < n; ++k)
+	{
+	    binX[k] = particles[binParticles[k]].x;
+	    binY[k] = particles[binParticles[k]].y;
+	    binAX[k] = binAY[k] = 0.0;
 	}
 
 	//
         //  compute forces
         //
+	if(verlet)
+	{
+	if(rebuild)
+	{
+	// Count the neighbors of each particle, make room for them, and list them
+#pragma omp for
+	for(int k = 0; k < n; ++k)
+	{
+	  int bin = particleBin[binParticles[k]];
+	  neighborStart[k] = verlet_neighbors(binX, binY, k, binStart, numCells, bin / numCells, bin % numCells,
+					      CUTOFF + skin, NULL);
+	}
+	prefix_sum(neighborStart, neighborStart, n, blockSum);
+#pragma omp single
+	if(neighborStart[n] > neighborCapacity)
+	{
+	  neighborCapacity = neighborStart[n] + neighborStart[n] / 4;
+	  neighbors = (int*) realloc(neighbors, neighborCapacity * sizeof(int));
+	}
+#pragma omp for
+	for(int k = 0; k < n; ++k)
+	{
+	  int bin = particleBin[binParticles[k]];
+	  verlet_neighbors(binX, binY, k, binStart, numCells, bin / numCells, bin % numCells,
+			   CUTOFF + skin, neighbors + neighborStart[k]);
+	}
+#pragma omp for
+	for(int i = 0; i < n; ++i)
+	{
+	  rebuildX[i] = particles[i].x;
+	  rebuildY[i] = particles[i].y;
+	}
+	}
 
-	//Start Parallel Section
-#pragma omp parallel
+	// Between rebuilds, a step only streams through the lists
+#pragma omp for reduction(+:navg) reduction(+:davg) reduction(min:dmin)
+	for(int k = 0; k < n; ++k)
 	{
-	//Figure out how many threads we have for later
-	numThreads = omp_get_num_threads();
-#pragma omp for collapse(2) reduction(+:navg) reduction(+:davg) firstprivate(dmin) schedule(dynamic)
+	  double fx = 0.0, fy = 0.0, minR2 = CUTOFF * CUTOFF;
+	  list_force(binX, binY, k, neighbors, neighborStart[k], neighborStart[k + 1], &fx, &fy, &minR2, &davg, &navg);
+	  particles[binParticles[k]].ax = fx;
+	  particles[binParticles[k]].ay = fy;
+	  dmin = fmin(dmin, sqrt(minR2) / CUTOFF);
+	}
+	}
+	else if(half)
+	{
+	// Half shell: the particles of bin (r, c) only meet the particles after
+	// them in the bin and in bin (r, c+1) (one range), and bins (r+1, c-1)
+	// to (r+1, c+1) (another range).  A row of bins then writes forces to
+	// itself and the next row, so the rows are computed in two passes, even
+	// rows then odd rows, and no two threads write to the same particle.
+	for(int color = 0; color < 2; ++color)
+	{
+#pragma omp for reduction(+:navg) reduction(+:davg) reduction(min:dmin) schedule(dynamic, 4)
+	for(int r = color; r < numCells; r += 2)
+	{
+	  double minR2 = CUTOFF * CUTOFF;
+	  for(int k = binStart[r * numCells]; k < binStart[(r + 1) * numCells]; ++k)
+	  {
+	    int c = particleBin[binParticles[k]] % numCells;
+	    bin_force_half(binX, binY, binAX, binAY, k, k + 1, binStart[r * numCells + min(c + 2, numCells)],
+			   &minR2, &davg, &navg);
+	    if(r + 1 < numCells)
+	      bin_force_half(binX, binY, binAX, binAY, k, binStart[(r + 1) * numCells + max(c - 1, 0)],
+			     binStart[(r + 1) * numCells + min(c + 2, numCells)], &minR2, &davg, &navg);
+	  }
+	  dmin = fmin(dmin, sqrt(minR2) / CUTOFF);
+	}
+	}
+#pragma omp for
+	for(int k = 0; k < n; ++k)
+	{
+	  particles[binParticles[k]].ax = binAX[k];
+	  particles[binParticles[k]].ay = binAY[k];
+	}
+	}
+	else if(!scalar)
+	{
+	// Particles in bin order: the 3 bins of a row of neighbors are one
+	// range of binX, binY
+#pragma omp for reduction(+:navg) reduction(+:davg) reduction(min:dmin)
+	for(int k = 0; k < n; ++k)
+	{
+	  int bin = particleBin[binParticles[k]];
+	  int r = bin / numCells, c = bin % numCells;
+	  int firstCol = max(c - 1, 0), lastCol = min(c + 1, numCells - 1);
+	  double fx = 0.0, fy = 0.0, minR2 = CUTOFF * CUTOFF;
+	  for(int i = max(r - 1, 0); i <= min(r + 1, numCells - 1); ++i)
+	    bin_force(binX, binY, k, binStart[i * numCells + firstCol], binStart[i * numCells + lastCol + 1],
+		      &fx, &fy, &minR2, &davg, &navg);
+	  particles[binParticles[k]].ax = fx;
+	  particles[binParticles[k]].ay = fy;
+	  dmin = fmin(dmin, sqrt(minR2) / CUTOFF);
+	}
+	}
+	else
+	{
+#pragma omp for collapse(2) reduction(+:navg) reduction(+:davg) reduction(min:dmin) schedule(dynamic, 64)
         for(int r = 0; r < numCells; ++r)
 	{
 	  for(int c = 0; c < numCells; ++c)
 	  {
-	    // Get the number of threads
-	   
-	    // Storage for the current bin and neighboring bins
-	    std::vector<std::vector<particle_t*>> nearBins;
-
-	    //Store the neighbors which is 3x3 around (c, r) 
-	    for(int i = r - 1; i <= r + 1; ++i)
-	      for(int j = c - 1; j <= c + 1; ++j)
-		if(i >= 0 && i < numCells && j >= 0 && j < numCells)
-		  nearBins.push_back(partBins[i][j]);
-
-	    //Find forces for each particle in the current bin 
-	    std::vector<particle_t*> currBin = partBins[r][c];
-	    for(int p = 0; p < currBin.size(); ++p)
+	    //Find forces for each particle in the current bin
+	    int bin = r * numCells + c;
+	    for(int p = binStart[bin]; p < binStart[bin + 1]; ++p)
 	    {
-	       currBin[p]->ax = currBin[p]->ay = 0;
+	       particle_t &particle = particles[binParticles[p]];
+	       particle.ax = particle.ay = 0;
 
-	       //Iterate through the nearby bins (nbi -> near bin index)
-	       for(int nbi = 0; nbi < nearBins.size(); ++nbi)
+	       //Iterate through the nearby bins, 3x3 around (c, r)
+	       for(int i = max(r - 1, 0); i <= min(r + 1, numCells - 1); ++i)
 	       {
-		  //Get the current neighbor and iterate through particles and apply force
-		  std::vector<particle_t*> neighbor = nearBins[nbi];
-
-		  //Iteration through nearby particles (nbp)
-		  for(int nbp = 0; nbp < neighbor.size(); ++nbp)
-			  apply_force(*currBin[p], *neighbor[nbp], &dmin, &davg, &navg);
+		 for(int j = max(c - 1, 0); j <= min(c + 1, numCells - 1); ++j)
+		 {
+		   //Iteration through nearby particles (nbp)
+		   int neighbor = i * numCells + j;
+		   for(int nbp = binStart[neighbor]; nbp < binStart[neighbor + 1]; ++nbp)
+		     apply_force(particle, particles[binParticles[nbp]], &dmin, &davg, &navg);
+		 }
 	       }
 	    }
 	  }
 	}
+	}
  
         //
         //  move particles
@@ -136,6 +733,18 @@ int main( int argc, char **argv )
         for( int i = 0; i < n; i++ ) 
             move( particles[i] );		
 
+	// -verlet: the largest distance from the positions of the last rebuild
+	if(verlet)
+	{
+#pragma omp for reduction(max:maxMove2)
+	for(int i = 0; i < n; ++i)
+	{
+	    double dx = particles[i].x - rebuildX[i];
+	    double dy = particles[i].y - rebuildY[i];
+	    maxMove2 = fmax(maxMove2, dx * dx + dy * dy);
+	}
+	}
+
         if( find_option( argc, argv, "-no" ) == -1 )
         {
           //
@@ -156,15 +765,46 @@ int main( int argc, char **argv )
           //
 #pragma omp master
           if( fsave && (step%SAVEFREQ) == 0 )
-              save( fsave, n, particles );
+          {
+              if( saved )
+              {
+                  for( int i = 0; i < n; i++ )
+                      saved[original[i]] = particles[i];
+                  save( fsave, n, saved );
+              }
+              else
+                  save( fsave, n, particles );
+          }
         }
     }
 
     //End parallel section
+
+	if(verlet && rebuild)
+	    numRebuilds++;
+	rebuild = maxMove2 > skin * skin / 4;
     }
     simulation_time = read_timer( ) - simulation_time;
+    if( countMisses )
+    {
+#pragma omp parallel reduction(+:misses) reduction(&&:missesAvailable)
+        {
+            long long count = read_miss_counter( missCounters[omp_get_thread_num()] );
+            missesAvailable = count >= 0;
+            misses += count;
+        }
+    }
     
     printf( "n = %d, threads = %d, simulation time = %g seconds", n, numThreads, simulation_time);
+    if( verlet )
+        printf( ", %d rebuilds of the neighbor lists", numRebuilds );
+    if( countMisses )
+    {
+        if( missesAvailable )
+            printf( ", cache misses = %lld", misses );
+        else
+            printf( ", cache misses not available" );
+    }
 
     if( find_option( argc, argv, "-no" ) == -1 )
     {
@@ -194,6 +834,29 @@ int main( int argc, char **argv )
     if( fsum )
         fclose( fsum );    
     free( particles );
+    free( binStart );
+    free( binFill );
+    free( binParticles );
+    free( particleBin );
+    free( blockSum );
+    free( binX );
+    free( binY );
+    free( binAX );
+    free( binAY );
+    free( neighborStart );
+    free( neighbors );
+    free( rebuildX );
+    free( rebuildY );
+    free( original );
+    free( sortKeys );
+    free( tempKeys );
+    free( sortValues );
+    free( tempValues );
+    free( histogram );
+    free( reorderedOriginal );
+    free( reordered );
+    free( saved );
+    free( missCounters );
     if( fsave )
         fclose( fsave );
     